@@ -0,0 +1,101 @@
+// Copyright Project Borealis
+
+#include "Character/PBCorrectionLogSubsystem.h"
+
+#include "Engine/World.h"
+#include "HAL/FileManager.h"
+#include "HAL/IConsoleManager.h"
+#include "Misc/PackageName.h"
+#include "Misc/Paths.h"
+
+static TAutoConsoleVariable<int32> CVarLogCorrections(TEXT("pb.Corrections.Log"), 0, TEXT("Write the client corrections sent by the server to a binary file in the log directory, one file per world and session.\n"), ECVF_Default);
+static TAutoConsoleVariable<float> CVarLogCorrectionsFlushInterval(TEXT("pb.Corrections.LogFlushInterval"), 5.0f, TEXT("Seconds between two writes of the buffered client corrections to the correction log.\n"), ECVF_Default);
+
+DEFINE_LOG_CATEGORY_STATIC(LogPBCorrections, Log, All);
+
+void UPBCorrectionLogSubsystem::Deinitialize()
+{
+	CloseLog();
+	Super::Deinitialize();
+}
+
+TStatId UPBCorrectionLogSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UPBCorrectionLogSubsystem, STATGROUP_Tickables);
+}
+
+void UPBCorrectionLogSubsystem::AddRecord(const FPBCorrectionRecord& Record)
+{
+	if (CVarLogCorrections.GetValueOnGameThread() != 0 && !bLogFailed)
+	{
+		PendingRecords.Add(Record);
+	}
+}
+
+void UPBCorrectionLogSubsystem::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	if (CVarLogCorrections.GetValueOnGameThread() == 0)
+	{
+		CloseLog();
+		return;
+	}
+
+	TimeSinceFlush += DeltaTime;
+	if (PendingRecords.Num() > 0 && TimeSinceFlush >= CVarLogCorrectionsFlushInterval.GetValueOnGameThread())
+	{
+		FlushRecords();
+	}
+}
+
+void UPBCorrectionLogSubsystem::FlushRecords()
+{
+	TimeSinceFlush = 0.0f;
+	if (PendingRecords.Num() == 0)
+	{
+		return;
+	}
+
+	if (!Log && !bLogFailed)
+	{
+		// PIE worlds and the servers and clients of a process each get their own file
+		const FString WorldName = FPackageName::GetShortName(GetWorld()->GetOutermost()->GetName());
+		const TCHAR* NetMode = GetWorld()->GetNetMode() == NM_DedicatedServer ? TEXT("Server") : GetWorld()->GetNetMode() == NM_ListenServer ? TEXT("ListenServer") : TEXT("Local");
+		const FString Filename = FPaths::ProjectLogDir() / FString::Printf(TEXT("PBCorrections-%s-%s-%s.bin"), *WorldName, NetMode, *FDateTime::Now().ToString());
+		Log.Reset(IFileManager::Get().CreateFileWriter(*Filename));
+		if (!Log)
+		{
+			UE_LOG(LogPBCorrections, Warning, TEXT("Can't write the correction log to %s"), *Filename);
+			bLogFailed = true;
+			PendingRecords.Empty();
+			return;
+		}
+		UE_LOG(LogPBCorrections, Log, TEXT("Logging client corrections to %s"), *Filename);
+
+		// Header, so readers can tell the format
+		uint32 Magic = 0x52434250; // "PBCR"
+		uint32 Version = 1;
+		*Log << Magic << Version;
+	}
+
+	if (Log)
+	{
+		for (FPBCorrectionRecord& Record : PendingRecords)
+		{
+			*Log << Record;
+		}
+		Log->Flush();
+	}
+	PendingRecords.Reset();
+}
+
+void UPBCorrectionLogSubsystem::CloseLog()
+{
+	FlushRecords();
+	if (Log)
+	{
+		Log->Close();
+		Log.Reset();
+	}
+}
@@ -12,8 +12,11 @@
 #include "Components/CapsuleComponent.h"
 #include "HAL/IConsoleManager.h"
 #include "Engine/World.h"
+#include "Net/UnrealNetwork.h"
 
 #include "Character/PBPlayerMovement.h"
+#include "LagCompensation/PBLagCompensationSubsystem.h"
+#include "Ladder/PBLadderSubsystem.h"
 
 static TAutoConsoleVariable<int32> CVarAutoBHop(TEXT("move.Pogo"), 1, TEXT("If holding spacebar should make the player jump whenever possible.\n"), ECVF_Default);
 
@@ -54,6 +57,16 @@ APBPlayerCharacter::APBPlayerCharacter(const FObjectInitializer& ObjectInitializ
 	CapDamageMomentumZ = 476.25f;
 }
 
+void APBPlayerCharacter::GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const
+{
+	Super::GetLifetimeReplicatedProps(OutLifetimeProps);
+
+	// The owner finds its own floor
+	DOREPLIFETIME_CONDITION(APBPlayerCharacter, ReplicatedFloorSurface, COND_SimulatedOnly);
+	// The owner predicts its own crouch transition
+	DOREPLIFETIME_CONDITION(APBPlayerCharacter, ReplicatedCrouchAlpha, COND_SimulatedOnly);
+}
+
 void APBPlayerCharacter::BeginPlay()
 {
 	// Call the base class
@@ -61,14 +74,151 @@ void APBPlayerCharacter::BeginPlay()
 	// Subscribe to events
 	GetCapsuleComponent()->OnComponentBeginOverlap.AddDynamic(this, &APBPlayerCharacter::HandleBeginOverlap);
 	GetCapsuleComponent()->OnComponentEndOverlap.AddDynamic(this, &APBPlayerCharacter::HandleEndOverlap);
+	// Cache the bounds of the ladders already in the world
+	if (UPBLadderSubsystem* LadderSubsystem = GetWorld()->GetSubsystem<UPBLadderSubsystem>())
+	{
+		LadderSubsystem->RegisterLaddersByObjectType(LadderObjectType);
+	}
+	// Remember the configured bounds before we start changing the frequency
+#if ENGINE_MAJOR_VERSION == 5 && ENGINE_MINOR_VERSION >= 5
+	ConfiguredMinNetUpdateFrequency = GetMinNetUpdateFrequency();
+#else
+	ConfiguredMinNetUpdateFrequency = MinNetUpdateFrequency;
+#endif
+	ConfiguredMaxNetUpdateFrequency = GetNetUpdateFrequencyCompat();
+	// Servers keep our capsule history for lag compensation
+	if (HasAuthority() && !IsNetMode(NM_Standalone))
+	{
+		if (UPBLagCompensationSubsystem* LagCompensationSubsystem = GetWorld()->GetSubsystem<UPBLagCompensationSubsystem>())
+		{
+			LagCompensationSubsystem->RegisterCharacter(this);
+		}
+	}
 	// Max jump time to get to the top of the arc
 	MaxJumpTime = -4.0f * GetCharacterMovement()->JumpZVelocity / (3.0f * GetCharacterMovement()->GetGravityZ());
+	RebuildMoveStepSoundSets();
+	// Sounds are loaded on demand, have the fallback and ladder sounds ready. Servers don't play any.
+	if (!IsNetMode(NM_DedicatedServer))
+	{
+		PreloadMoveStepSounds({ SurfaceType_Default, SurfaceType1 });
+	}
+}
+
+const FPBMoveStepSoundSet& APBPlayerCharacter::GetMoveStepSoundSet(EPhysicalSurface Surface)
+{
+	const FPBMoveStepSoundSet& SoundSet = MoveStepSoundSets[Surface];
+	if (SoundSet.bNeedsLoad)
+	{
+		LoadMoveStepSounds(Surface);
+	}
+	return SoundSet;
+}
+
+void APBPlayerCharacter::PreloadMoveStepSounds(const TArray<TEnumAsByte<EPhysicalSurface>>& Surfaces)
+{
+	for (const TEnumAsByte<EPhysicalSurface> Surface : Surfaces)
+	{
+		LoadMoveStepSounds(Surface);
+	}
+}
+
+void APBPlayerCharacter::LoadMoveStepSounds(EPhysicalSurface Surface)
+{
+	const uint64 SurfaceBit = 1ull << Surface;
+	if (RequestedMoveStepSounds & SurfaceBit)
+	{
+		return;
+	}
+	RequestedMoveStepSounds |= SurfaceBit;
+
+	const TSubclassOf<UPBMoveStepSound>* SoundClass = MoveStepSounds.Find(TEnumAsByte<EPhysicalSurface>(Surface));
+	if (SoundClass && *SoundClass)
+	{
+		SoundClass->GetDefaultObject()->LoadSounds(FSimpleDelegate::CreateUObject(this, &APBPlayerCharacter::RebuildMoveStepSoundSets));
+	}
+}
+
+void APBPlayerCharacter::RebuildMoveStepSoundSets()
+{
+	const auto GetSurfaceSound = [this](EPhysicalSurface Surface) -> const UPBMoveStepSound*
+	{
+		const TSubclassOf<UPBMoveStepSound>* SoundClass = MoveStepSounds.Find(TEnumAsByte<EPhysicalSurface>(Surface));
+		return SoundClass && *SoundClass ? SoundClass->GetDefaultObject() : nullptr;
+	};
+	const auto GetLoadedSurfaceSound = [&GetSurfaceSound](EPhysicalSurface Surface) -> const UPBMoveStepSound*
+	{
+		const UPBMoveStepSound* SurfaceSound = GetSurfaceSound(Surface);
+		return SurfaceSound && SurfaceSound->AreSoundsLoaded() ? SurfaceSound : nullptr;
+	};
+	const auto PickSounds = [](const TArray<USoundCue*>& Sounds, const TArray<USoundCue*>& Fallback) -> const TArray<USoundCue*>*
+	{
+		return Sounds.Num() > 0 ? &Sounds : &Fallback;
+	};
+
+	const UPBMoveStepSound* DefaultSound = GetLoadedSurfaceSound(SurfaceType_Default);
+	for (int32 Surface = 0; Surface < SurfaceType_Max; ++Surface)
+	{
+		FPBMoveStepSoundSet& SoundSet = MoveStepSoundSets[Surface];
+		SoundSet = FPBMoveStepSoundSet();
+
+		// Surfaces whose sounds are still streaming in use the default surface sounds
+		const UPBMoveStepSound* SurfaceSound = GetLoadedSurfaceSound((EPhysicalSurface)Surface);
+		SoundSet.bNeedsLoad = !SurfaceSound && GetSurfaceSound((EPhysicalSurface)Surface) != nullptr;
+		SoundSet.bHasSurfaceSounds = SurfaceSound != nullptr;
+		SoundSet.MoveStepSound = SurfaceSound ? SurfaceSound : DefaultSound;
+		if (!SoundSet.MoveStepSound)
+		{
+			continue;
+		}
+		const UPBMoveStepSound* FallbackSound = DefaultSound ? DefaultSound : SoundSet.MoveStepSound;
+
+		// Missing steps use the default surface steps
+		SoundSet.StepLeftSounds = PickSounds(SoundSet.MoveStepSound->GetStepLeftSounds(), FallbackSound->GetStepLeftSounds());
+		SoundSet.StepRightSounds = PickSounds(SoundSet.MoveStepSound->GetStepRightSounds(), FallbackSound->GetStepRightSounds());
+		// Missing sprints use our steps, then the default surface sprints, then the default surface steps
+		const TArray<USoundCue*>* SprintLeftFallback = SoundSet.MoveStepSound->GetStepLeftSounds().Num() > 0 ? &SoundSet.MoveStepSound->GetStepLeftSounds() : PickSounds(FallbackSound->GetSprintLeftSounds(), FallbackSound->GetStepLeftSounds());
+		const TArray<USoundCue*>* SprintRightFallback = SoundSet.MoveStepSound->GetStepRightSounds().Num() > 0 ? &SoundSet.MoveStepSound->GetStepRightSounds() : PickSounds(FallbackSound->GetSprintRightSounds(), FallbackSound->GetStepRightSounds());
+		SoundSet.SprintLeftSounds = PickSounds(SoundSet.MoveStepSound->GetSprintLeftSounds(), *SprintLeftFallback);
+		SoundSet.SprintRightSounds = PickSounds(SoundSet.MoveStepSound->GetSprintRightSounds(), *SprintRightFallback);
+		// Jumps and landings only fall back to the default surface when the surface has no sounds at all
+		SoundSet.JumpSounds = &SoundSet.MoveStepSound->GetJumpSounds();
+		SoundSet.LandSounds = &SoundSet.MoveStepSound->GetLandSounds();
+	}
+}
+
+void APBPlayerCharacter::EndPlay(const EEndPlayReason::Type EndPlayReason)
+{
+	if (UPBLagCompensationSubsystem* LagCompensationSubsystem = GetWorld()->GetSubsystem<UPBLagCompensationSubsystem>())
+	{
+		LagCompensationSubsystem->UnregisterCharacter(this);
+	}
+	CapsuleHistory.Reset();
+	Super::EndPlay(EndPlayReason);
+}
+
+void APBPlayerCharacter::RecordCapsule(float Time)
+{
+	const UCapsuleComponent* Capsule = GetCapsuleComponent();
+	const UCharacterMovementComponent* Movement = GetCharacterMovement();
+
+	FPBCapsuleSample Sample;
+	Sample.Timestamp = Time;
+	Sample.Location = Capsule->GetComponentLocation();
+	Sample.Rotation = Capsule->GetComponentQuat();
+	Sample.CapsuleHalfHeight = Capsule->GetScaledCapsuleHalfHeight();
+	Sample.MovementMode = Movement->MovementMode;
+	Sample.CustomMovementMode = Movement->CustomMovementMode;
+	CapsuleHistory.Record(Sample);
 }
 
 void APBPlayerCharacter::Tick(float DeltaTime)
 {
 	Super::Tick(DeltaTime);
 
+	if (bAdaptiveNetUpdateFrequency && HasAuthority() && !IsNetMode(NM_Standalone))
+	{
+		UpdateNetUpdateFrequency(DeltaTime);
+	}
 
 	if (bDeferJumpStop)
 	{
@@ -77,6 +227,62 @@ void APBPlayerCharacter::Tick(float DeltaTime)
 	}
 }
 
+void APBPlayerCharacter::UpdateNetUpdateFrequency(float DeltaTime)
+{
+	const UCharacterMovementComponent* Movement = GetCharacterMovement();
+	const float MinFrequency = FMath::Max(ConfiguredMinNetUpdateFrequency, 1.0f);
+	const float MaxFrequency = FMath::Max(ConfiguredMaxNetUpdateFrequency, MinFrequency);
+
+	// Fast players travel far between updates
+	float Urgency = FMath::Clamp(Movement->Velocity.Size() / MaxNetUpdateFrequencySpeed, 0.0f, 1.0f);
+
+	// Steering needs to be seen, steady acceleration is predicted well by proxies
+	const FVector Acceleration = Movement->GetCurrentAcceleration();
+	const float MaxAcceleration = Movement->GetMaxAcceleration();
+	if (MaxAcceleration > 0.0f)
+	{
+		Urgency = FMath::Max(Urgency, FMath::Clamp((Acceleration - LastNetUpdateAcceleration).Size() / MaxAcceleration, 0.0f, 1.0f));
+	}
+	LastNetUpdateAcceleration = Acceleration;
+
+	const float TargetFrequency = FMath::Lerp(MinFrequency, MaxFrequency, Urgency);
+	const float CurrentFrequency = GetNetUpdateFrequencyCompat();
+	// Go up right away, come down slowly so we don't flap between rates
+	const float NewFrequency = TargetFrequency >= CurrentFrequency ? TargetFrequency : FMath::Max(CurrentFrequency - NetUpdateFrequencyDecayRate * DeltaTime, TargetFrequency);
+	if (!FMath::IsNearlyEqual(NewFrequency, CurrentFrequency, 0.5f))
+	{
+		SetNetUpdateFrequencyCompat(NewFrequency);
+	}
+}
+
+void APBPlayerCharacter::NotifyMovementTransition()
+{
+	if (!bAdaptiveNetUpdateFrequency || !HasAuthority() || IsNetMode(NM_Standalone))
+	{
+		return;
+	}
+	SetNetUpdateFrequencyCompat(FMath::Max(ConfiguredMaxNetUpdateFrequency, 1.0f));
+	ForceNetUpdate();
+}
+
+void APBPlayerCharacter::SetNetUpdateFrequencyCompat(float Frequency)
+{
+#if ENGINE_MAJOR_VERSION == 5 && ENGINE_MINOR_VERSION >= 5
+	SetNetUpdateFrequency(Frequency);
+#else
+	NetUpdateFrequency = Frequency;
+#endif
+}
+
+float APBPlayerCharacter::GetNetUpdateFrequencyCompat() const
+{
+#if ENGINE_MAJOR_VERSION == 5 && ENGINE_MINOR_VERSION >= 5
+	return GetNetUpdateFrequency();
+#else
+	return NetUpdateFrequency;
+#endif
+}
+
 void APBPlayerCharacter::HandleBeginOverlap(UPrimitiveComponent* OverlappedComponent, AActor* OtherActor, UPrimitiveComponent* OtherComp, int32 OtherBodyIndex, bool bFromSweep, const FHitResult& SweepResult)
 {
 	// If not a ladder, skip
@@ -89,6 +295,11 @@ void APBPlayerCharacter::HandleBeginOverlap(UPrimitiveComponent* OverlappedCompo
 		return;
 	}
 
+	// Make sure ladders spawned or streamed in later are registered too
+	if (UPBLadderSubsystem* LadderSubsystem = GetWorld()->GetSubsystem<UPBLadderSubsystem>()) {
+		LadderSubsystem->RegisterLadder(OtherComp);
+	}
+
 	// Start being on ladder
 	FLadderData ladder;
 	ladder.Target = OtherComp;
@@ -188,6 +399,9 @@ void APBPlayerCharacter::OnMovementModeChanged(EMovementMode PrevMovementMode, u
 		bWasJumping = false;
 	}
 
+	// Jumps, landings and ladder grabs all change our movement mode
+	NotifyMovementTransition();
+
 	K2_OnMovementModeChanged(PrevMovementMode, GetCharacterMovement()->MovementMode, PrevCustomMode, GetCharacterMovement()->CustomMovementMode);
 	MovementModeChangedDelegate.Broadcast(this, PrevMovementMode, PrevCustomMode);
 }
@@ -402,6 +616,12 @@ void APBPlayerCharacter::LookUp(bool bIsPure, float Rate)
 void APBPlayerCharacter::RecalculateBaseEyeHeight()
 {
 	const ACharacter* DefaultCharacter = GetClass()->GetDefaultObject<ACharacter>();
+	if (MovementPtr)
+	{
+		// The movement knows our progress between quantized capsule heights
+		BaseEyeHeight = FMath::Lerp(DefaultCharacter->BaseEyeHeight, CrouchedEyeHeight, SimpleSpline(MovementPtr->GetCrouchAlpha())) + MovementPtr->GetCrouchEyeHeightOffset();
+		return;
+	}
 	const float OldUnscaledHalfHeight = DefaultCharacter->GetCapsuleComponent()->GetUnscaledCapsuleHalfHeight();
 	const float CrouchedHalfHeight = GetCharacterMovement()->GetCrouchedHalfHeight();
 	const float FullCrouchDiff = OldUnscaledHalfHeight - CrouchedHalfHeight;
@@ -411,6 +631,24 @@ void APBPlayerCharacter::RecalculateBaseEyeHeight()
 	BaseEyeHeight = FMath::Lerp(DefaultCharacter->BaseEyeHeight, CrouchedEyeHeight, SimpleSpline(CurrentAlpha));
 }
 
+void APBPlayerCharacter::AdjustCrouchedMesh(float HalfHeightAdjust)
+{
+	// UE4-COPY: void ACharacter::OnStartCrouch(float HalfHeightAdjust, float ScaledHalfHeightAdjust)
+	RecalculateBaseEyeHeight();
+
+	const ACharacter* DefaultCharacter = GetClass()->GetDefaultObject<ACharacter>();
+	if (GetMesh() && DefaultCharacter->GetMesh())
+	{
+		FVector& MeshRelativeLocation = GetMesh()->GetRelativeLocation_DirectMutable();
+		MeshRelativeLocation.Z = DefaultCharacter->GetMesh()->GetRelativeLocation().Z + HalfHeightAdjust;
+		BaseTranslationOffset.Z = MeshRelativeLocation.Z;
+	}
+	else
+	{
+		BaseTranslationOffset.Z = DefaultCharacter->GetBaseTranslationOffset().Z + HalfHeightAdjust;
+	}
+}
+
 bool APBPlayerCharacter::CanCrouch() const
 {
 	return bAllowCrouch && !GetCharacterMovement()->bCheatFlying && Super::CanCrouch() && !MovementPtr->IsOnLadder();
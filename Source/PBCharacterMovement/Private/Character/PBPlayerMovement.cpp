@@ -2,6 +2,7 @@
 
 #include "Character/PBPlayerMovement.h"
 
+#include "Components/AudioComponent.h"
 #include "Components/CapsuleComponent.h"
 #include "Engine/Canvas.h"
 #include "Engine/Engine.h"
@@ -9,20 +10,50 @@
 #include "GameFramework/Character.h"
 #include "GameFramework/PhysicsVolume.h"
 #include "HAL/IConsoleManager.h"
-#include "Kismet/GameplayStatics.h"
 #include "PhysicalMaterials/PhysicalMaterial.h"
 #include "PhysicsEngine/PhysicsSettings.h"
 #include "Sound/SoundCue.h"
 #include "ProfilingDebugging/CsvProfiler.h"
+#include "UObject/UObjectIterator.h"
 
 #include "Sound/PBMoveStepSound.h"
+#include "Character/PBCorrectionLogSubsystem.h"
 #include "Character/PBPlayerCharacter.h"
+#include "Ladder/PBLadderSubsystem.h"
+#include "Sound/PBFootstepSubsystem.h"
 
 static TAutoConsoleVariable<int32> CVarShowPos(TEXT("cl.ShowPos"), 0, TEXT("Show position and movement information.\n"), ECVF_Default);
 
+DEFINE_LOG_CATEGORY_STATIC(LogPBMovement, Log, All);
+
+CSV_DEFINE_CATEGORY(PBMovement, true);
+
 DECLARE_CYCLE_STAT(TEXT("Char StepUp"), STAT_CharStepUp, STATGROUP_Character);
 DECLARE_CYCLE_STAT(TEXT("Char PhysFalling"), STAT_CharPhysFalling, STATGROUP_Character);
 DECLARE_CYCLE_STAT(TEXT("Char PhysLadder"), STAT_CharPhysLadder, STATGROUP_Character);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Char Floor Sample Cache Hits"), STAT_CharFloorSampleCacheHit, STATGROUP_Character);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Char Floor Sample Cache Misses"), STAT_CharFloorSampleCacheMiss, STATGROUP_Character);
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("Sweeps"), STAT_PBSceneQuerySweep, STATGROUP_PBMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Line Traces"), STAT_PBSceneQueryLineTrace, STATGROUP_PBMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Overlaps"), STAT_PBSceneQueryOverlap, STATGROUP_PBMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Queries: Move"), STAT_PBSceneQueryMove, STATGROUP_PBMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Queries: FindFloor"), STAT_PBSceneQueryFindFloor, STATGROUP_PBMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Queries: StepUp"), STAT_PBSceneQueryStepUp, STATGROUP_PBMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Queries: Floor Sample"), STAT_PBSceneQueryFloorSample, STATGROUP_PBMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Queries: Falling Probe"), STAT_PBSceneQueryFallingProbe, STATGROUP_PBMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Queries: Local Geometry"), STAT_PBSceneQueryLocalGeometry, STATGROUP_PBMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Queries: Uncrouch"), STAT_PBSceneQueryUncrouch, STATGROUP_PBMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Queries: Ladder"), STAT_PBSceneQueryLadder, STATGROUP_PBMovement);
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("Corrections"), STAT_PBCorrections, STATGROUP_PBMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Corrections: Ladder"), STAT_PBCorrectionsLadder, STATGROUP_PBMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Corrections: Power Slide"), STAT_PBCorrectionsPowerSlide, STATGROUP_PBMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Corrections: Water"), STAT_PBCorrectionsWater, STATGROUP_PBMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Corrections: Crouch Transition"), STAT_PBCorrectionsCrouchTransition, STATGROUP_PBMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Corrections: Coyote Jump"), STAT_PBCorrectionsCoyoteJump, STATGROUP_PBMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Corrections: Other"), STAT_PBCorrectionsOther, STATGROUP_PBMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("State Hash Mismatches"), STAT_PBStateHashMismatches, STATGROUP_PBMovement);
 
 // Defines for build configs
 #if DO_CHECK && !UE_BUILD_SHIPPING // Disable even if checks in shipping are enabled.
@@ -99,9 +130,7 @@ UPBPlayerMovement::UPBPlayerMovement()
 	// Speed multiplier bounds
 	SpeedMultMin = SprintSpeed * 1.7f;
 	SpeedMultMax = SprintSpeed * 2.5f;
-	// Start out braking
-	bBrakingWindowElapsed = true;
-	BrakingWindowTimeElapsed = 0.f;
+	// Start out braking, GroundedStartTime is in the distant past
 	BrakingWindow = 15.f;
 	// Crouching
 	SetCrouchedHalfHeight(34.29f);
@@ -148,6 +177,8 @@ UPBPlayerMovement::UPBPlayerMovement()
 	GravityScale = DesiredGravity / UPhysicsSettings::Get()->DefaultGravityZ;
 	// Make sure ramp movement in correct
 	bMaintainHorizontalGroundVelocity = true;
+	// Send the PB state hash with client moves
+	SetNetworkMoveDataContainer(PBNetworkMoveDataContainer);
 }
 
 void UPBPlayerMovement::InitializeComponent()
@@ -161,61 +192,120 @@ void UPBPlayerMovement::OnRegister()
 	Super::OnRegister();
 
 	const bool bIsReplay = (GetWorld() && GetWorld()->IsPlayingReplay());
-	if (!bIsReplay && GetNetMode() == NM_ListenServer)
+	if (bUseExtrapolatedNetworkSmoothing)
+	{
+		// Our extrapolation is applied on top of the exponential decay of corrections
+		NetworkSmoothingMode = ENetworkSmoothingMode::Exponential;
+	}
+	else if (!bIsReplay && GetNetMode() == NM_ListenServer)
 	{
 		NetworkSmoothingMode = ENetworkSmoothingMode::Linear;
 	}
 }
 
-void UPBPlayerMovement::TickComponent(float DeltaTime, enum ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
-{	
-	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
-	PlayMoveSound(DeltaTime);
+void UPBPlayerMovement::SmoothCorrection(const FVector& OldLocation, const FQuat& OldRotation, const FVector& NewLocation, const FQuat& NewRotation)
+{
+	Super::SmoothCorrection(OldLocation, OldRotation, NewLocation, NewRotation);
 
-	if (bHasDeferredMovementMode)
+	if (!bUseExtrapolatedNetworkSmoothing || !HasValidData())
 	{
-		bHasDeferredMovementMode = false;
-		SetMovementMode(DeferredMovementMode);
+		return;
 	}
 
-	// Increment powersliding window
-	if (!bIsPowerSliding) {
-		PowerSlidingTimeElapsed += DeltaTime * 1000;
-		if (PowerSlidingTimeElapsed >= SlidingBoostCooldown) {
-			PowerSlidingTimeElapsed = INFINITY;
-		}
+	// The engine left the mesh where it was drawn, that's our error from the new update
+	const FNetworkPredictionData_Client_Character* ClientData = GetPredictionData_Client_Character();
+	SmoothingError = ClientData ? ClientData->MeshTranslationOffset : FVector::ZeroVector;
+
+	SmoothingSample.Location = NewLocation;
+	SmoothingSample.Velocity = Velocity;
+	SmoothingSample.Time = GetWorld()->GetTimeSeconds();
+	SmoothingSample.MovementMode = MovementMode;
+	SmoothingSample.bIsCrouched = IsCrouching();
+	SmoothingSample.bValid = true;
+}
+
+void UPBPlayerMovement::SmoothClientPosition(float DeltaSeconds)
+{
+	if (!bUseExtrapolatedNetworkSmoothing || !HasValidData() || NetworkSmoothingMode == ENetworkSmoothingMode::Disabled)
+	{
+		Super::SmoothClientPosition(DeltaSeconds);
+		return;
 	}
 
-	// Ladder regrab window if we are not on a ladder
-	if (!IsOnLadder() && !FMath::IsNearlyZero(GrabSameLadderCooldown)) {
-		// Increment timer
-		LadderRegrabTimeElapsed += DeltaTime * 1000;
-		// Window is over, we can regrab
-		if (LadderRegrabTimeElapsed >= GrabSameLadderCooldown) {
-			LadderRegrabTimeElapsed = INFINITY;
-			// Check if we have regrabbable ladder data saved
-			if (RegrabbableLadderData.IsSet() && IsValid(RegrabbableLadderData->Target)) {
-				// If we are still on ladder, regrab. If we are not,
-				// then remove the potential ladder data
-				if (OverlapsLadder(RegrabbableLadderData.GetValue())) {
-					GrabLadder(RegrabbableLadderData.GetValue());
-				}
-				else {
-					RegrabbableLadderData.Reset();
-				}
-			}
-		}
+	FNetworkPredictionData_Client_Character* ClientData = GetPredictionData_Client_Character();
+	if (!ClientData)
+	{
+		return;
 	}
-	else {
-		LadderRegrabTimeElapsed = 0.;
+
+	// Rotation smoothing from the engine, the translation offset is ours
+	SmoothClientPosition_Interpolate(DeltaSeconds);
+
+	// Bleed off the error of the last correction, no faster than MaxSmoothingCorrectionSpeed
+	const bool bIsSimulatedProxy = CharacterOwner->GetLocalRole() == ROLE_SimulatedProxy;
+	const float SmoothLocationTime = bIsSimulatedProxy ? NetworkSimulatedSmoothLocationTime : ListenServerNetworkSimulatedSmoothLocationTime;
+	FVector Correction = DeltaSeconds < SmoothLocationTime ? SmoothingError * (DeltaSeconds / SmoothLocationTime) : SmoothingError;
+	Correction = Correction.GetClampedToMaxSize(MaxSmoothingCorrectionSpeed * DeltaSeconds);
+	SmoothingError -= Correction;
+
+	// Simulated proxies move their capsule with the PB movement between updates. Remote clients
+	// on a listen server only move with their moves, so their mesh keeps going from the last one.
+	FVector ExtrapolationOffset = FVector::ZeroVector;
+	if (!bIsSimulatedProxy && SmoothingSample.bValid)
+	{
+		const float ExtrapolationTime = FMath::Clamp(GetWorld()->GetTimeSeconds() - SmoothingSample.Time, 0.0f, MaxSmoothingExtrapolationTime);
+		ExtrapolationOffset = ExtrapolateSmoothingSample(ExtrapolationTime) - UpdatedComponent->GetComponentLocation();
+	}
+
+	ClientData->MeshTranslationOffset = SmoothingError + ExtrapolationOffset;
+	bNetworkSmoothingComplete = SmoothingError.IsNearlyZero(1e-2f) && (bIsSimulatedProxy || Velocity.IsNearlyZero());
+	SmoothClientPosition_UpdateVisuals();
+}
+
+FVector UPBPlayerMovement::ExtrapolateSmoothingSample(float Time) const
+{
+	const FVector& Start = SmoothingSample.Location;
+	const FVector& StartVelocity = SmoothingSample.Velocity;
+
+	if (SmoothingSample.MovementMode == MOVE_Falling)
+	{
+		// No friction in the air, only gravity
+		FVector Delta = StartVelocity * Time;
+		Delta.Z = FMath::Clamp(StartVelocity.Z + 0.5f * GetGravityZ() * Time, -AxisSpeedLimit, AxisSpeedLimit) * Time;
+		return Start + Delta;
 	}
 
-	// Increment coyote time window
-	if (IsFalling() && !FMath::IsNearlyZero(CoyoteTime) && !isinf(CoyoteTimeElapsed) && IsInCoyoteTime()) {
-		CoyoteTimeElapsed += DeltaTime * 1000;
+	const float Speed = StartVelocity.Size();
+	if (SmoothingSample.MovementMode == MOVE_Walking && SmoothingSample.bIsCrouched && Speed > SlidingStopSpeed && BrakingDecelerationSliding > 0.0f)
+	{
+		// Sliding loses speed at a constant rate, until it stops
+		const float SlideTime = FMath::Min(Time, (Speed - SlidingStopSpeed) / BrakingDecelerationSliding);
+		const float Distance = Speed * SlideTime - 0.5f * BrakingDecelerationSliding * FMath::Square(SlideTime) + SlidingStopSpeed * (Time - SlideTime);
+		return Start + StartVelocity / Speed * Distance;
 	}
-	else {
-		CoyoteTimeElapsed = INFINITY;
+
+	return Start + StartVelocity * Time;
+}
+
+void UPBPlayerMovement::TickComponent(float DeltaTime, enum ELevelTick TickType, FActorComponentTickFunction* ThisTickFunction)
+{	
+	Super::TickComponent(DeltaTime, TickType, ThisTickFunction);
+	// Simulated proxies don't run the crouch transition, they follow the server's
+	if (CharacterOwner && CharacterOwner->GetLocalRole() == ROLE_SimulatedProxy)
+	{
+		// No moves to advance our clock, only frames
+		SimulationTime += DeltaTime;
+		UpdateProxyCrouching(DeltaTime);
+	}
+	if (CanPlayMoveSounds())
+	{
+		PlayMoveSound(DeltaTime);
+	}
+
+	if (bHasDeferredMovementMode)
+	{
+		bHasDeferredMovementMode = false;
+		SetMovementMode(DeferredMovementMode);
 	}
 
 	// Skip player movement when we're simulating physics (ie ragdoll)
@@ -241,23 +331,6 @@ void UPBPlayerMovement::TickComponent(float DeltaTime, enum ELevelTick TickType,
 		PBCharacter->GetController()->SetControlRotation(ControlRotation);
 	}
 	
-	if (IsMovingOnGround())
-	{
-		if (!bBrakingWindowElapsed) BrakingWindowTimeElapsed += DeltaTime * 1000;
-
-		if (BrakingWindowTimeElapsed >= BrakingWindow)
-		{
-			bBrakingWindowElapsed = true;
-			BrakingWindowTimeElapsed = 0;
-		}
-	}
-	else
-	{
-		bBrakingWindowElapsed = false; // don't brake in the air lol
-		BrakingWindowTimeElapsed = 0;
-		// make sure this is cleared so the window doesn't shrink on subsequent bhops until it expires.
-	}
-
 	// Check for water updates
 	if (!IsSwimming() && IsTouchingWater() && IsInWater()) {
 		// Not swimming, but we are in deep enough water to start swimming
@@ -471,21 +544,101 @@ bool UPBPlayerMovement::IsValidLandingSpot(const FVector& CapsuleLocation, const
 	return true;
 }
 
+void UPBPlayerMovement::FindFloor(const FVector& CapsuleLocation, FFindFloorResult& OutFloorResult, bool bCanUseCachedResult, const FHitResult* DownwardSweepResult) const
+{
+	// A usable downward sweep replaces the floor sweep, and cached results come from CurrentFloor, neither match the memo
+	const bool bCanUseDownwardSweep = DownwardSweepResult
+		&& DownwardSweepResult->IsValidBlockingHit()
+		&& DownwardSweepResult->TraceStart.Z > DownwardSweepResult->TraceEnd.Z
+		&& (DownwardSweepResult->TraceStart - DownwardSweepResult->TraceEnd).SizeSquared2D() <= KINDA_SMALL_NUMBER;
+	if (!bMemoizeFindFloor || bCanUseCachedResult || bCanUseDownwardSweep)
+	{
+		Super::FindFloor(CapsuleLocation, OutFloorResult, bCanUseCachedResult, DownwardSweepResult);
+		return;
+	}
+
+	float PawnRadius, PawnHalfHeight;
+	CharacterOwner->GetCapsuleComponent()->GetScaledCapsuleSize(PawnRadius, PawnHalfHeight);
+	// The floor search also depends on these, which can change between two calls
+	const bool bIsMovingOnGround = IsMovingOnGround();
+	const float WalkableFloorZ = GetWalkableFloorZ();
+
+	if (FloorMemo.bValid
+		&& FVector::PointsAreSame(FloorMemo.Location, CapsuleLocation)
+		&& FloorMemo.Radius == PawnRadius && FloorMemo.HalfHeight == PawnHalfHeight
+		&& FloorMemo.MaxStepHeight == MaxStepHeight && FloorMemo.WalkableFloorZ == WalkableFloorZ
+		&& FloorMemo.bIsMovingOnGround == bIsMovingOnGround)
+	{
+		OutFloorResult = FloorMemo.Result;
+		return;
+	}
+
+	Super::FindFloor(CapsuleLocation, OutFloorResult, bCanUseCachedResult, DownwardSweepResult);
+
+	FloorMemo.Location = CapsuleLocation;
+	FloorMemo.Radius = PawnRadius;
+	FloorMemo.HalfHeight = PawnHalfHeight;
+	FloorMemo.MaxStepHeight = MaxStepHeight;
+	FloorMemo.WalkableFloorZ = WalkableFloorZ;
+	FloorMemo.bIsMovingOnGround = bIsMovingOnGround;
+	FloorMemo.Result = OutFloorResult;
+	FloorMemo.bValid = true;
+}
+
+void UPBPlayerMovement::ComputeFloorDist(const FVector& CapsuleLocation, float LineDistance, float SweepDistance, FFindFloorResult& OutFloorResult, float SweepRadius, const FHitResult* DownwardSweepResult) const
+{
+	// Let the floor query fetch physical materials, so surface friction can be read from CurrentFloor
+	TGuardValue<bool> RestoreComputingFloorDist(bIsComputingFloorDist, bUseFloorHitForSurfaceFriction);
+	Super::ComputeFloorDist(CapsuleLocation, LineDistance, SweepDistance, OutFloorResult, SweepRadius, DownwardSweepResult);
+
+	// Sweeps are counted by FloorSweepTest. The engine line traces without a virtual we could count in, but only returns
+	// early on a walkable sweep or when the sweep neither hit nor started penetrating. Any other result went through the trace.
+	const bool bSweepHitSomething = OutFloorResult.bBlockingHit || OutFloorResult.HitResult.bStartPenetrating;
+	if (LineDistance > 0.0f && (OutFloorResult.bLineTrace || (bSweepHitSomething && !OutFloorResult.bWalkableFloor)))
+	{
+		CountSceneQuery(EPBSceneQueryKind::LineTrace, bIsSteppingUp ? EPBSceneQuerySite::StepUp : EPBSceneQuerySite::FindFloor);
+	}
+}
+
+bool UPBPlayerMovement::FloorSweepTest(FHitResult& OutHit, const FVector& Start, const FVector& End, ECollisionChannel TraceChannel, const FCollisionShape& CollisionShape, const FCollisionQueryParams& Params, const FCollisionResponseParams& ResponseParam) const
+{
+	// Includes the second, narrower sweep the engine makes after a penetrating or edge hit
+	CountSceneQuery(EPBSceneQueryKind::Sweep, bIsSteppingUp ? EPBSceneQuerySite::StepUp : EPBSceneQuerySite::FindFloor);
+	return Super::FloorSweepTest(OutHit, Start, End, TraceChannel, CollisionShape, Params, ResponseParam);
+}
+
+void UPBPlayerMovement::InitCollisionParams(FCollisionQueryParams& OutParams, FCollisionResponseParams& OutResponseParam) const
+{
+	Super::InitCollisionParams(OutParams, OutResponseParam);
+	if (bIsComputingFloorDist)
+	{
+		OutParams.bReturnPhysicalMaterial = true;
+	}
+}
+
+void UPBPlayerMovement::InitFloorTrace(FCollisionQueryParams& OutParams, FCollisionResponseParams& OutResponseParam, FVector& OutStart, FVector& OutEnd) const
+{
+	InitCollisionParams(OutParams, OutResponseParam);
+	// must trace complex to get mesh phys materials
+	OutParams.bTraceComplex = true;
+	// must get materials
+	OutParams.bReturnPhysicalMaterial = true;
+
+	OutStart = UpdatedComponent->GetComponentLocation();
+	OutEnd = OutStart;
+	OutEnd.Z -= MAX_FLOOR_DIST * 10.0f;
+}
+
 void UPBPlayerMovement::TraceCharacterFloor(FHitResult& OutHit)
 {
 	FCollisionQueryParams CapsuleParams(SCENE_QUERY_STAT(CharacterFloorTrace), false, CharacterOwner);
 	FCollisionResponseParams ResponseParam;
-	InitCollisionParams(CapsuleParams, ResponseParam);
-	// must trace complex to get mesh phys materials
-	CapsuleParams.bTraceComplex = true;
-	// must get materials
-	CapsuleParams.bReturnPhysicalMaterial = true;
+	FVector PawnLocation, StandingLocation;
+	InitFloorTrace(CapsuleParams, ResponseParam, PawnLocation, StandingLocation);
 
 	const FCollisionShape StandingCapsuleShape = GetPawnCapsuleCollisionShape(SHRINK_None);
 	const ECollisionChannel CollisionChannel = UpdatedComponent->GetCollisionObjectType();
-	const FVector PawnLocation = UpdatedComponent->GetComponentLocation();
-	FVector StandingLocation = PawnLocation;
-	StandingLocation.Z -= MAX_FLOOR_DIST * 10.0f;
+	CountSceneQuery(EPBSceneQueryKind::Sweep, EPBSceneQuerySite::FloorSample);
 	GetWorld()->SweepSingleByChannel(
 		OutHit,
 		PawnLocation,
@@ -498,6 +651,113 @@ void UPBPlayerMovement::TraceCharacterFloor(FHitResult& OutHit)
 	);
 }
 
+void UPBPlayerMovement::RequestFootstepTrace()
+{
+	UWorld* World = GetWorld();
+	if (World->IsTraceHandleValid(FootstepTraceHandle, false))
+	{
+		// Still waiting for the last one
+		return;
+	}
+
+	FCollisionQueryParams CapsuleParams(SCENE_QUERY_STAT(CharacterFootstepTrace), false, CharacterOwner);
+	FCollisionResponseParams ResponseParam;
+	FVector Start, End;
+	InitFloorTrace(CapsuleParams, ResponseParam, Start, End);
+
+	if (!FootstepTraceDelegate.IsBound())
+	{
+		FootstepTraceDelegate.BindUObject(this, &UPBPlayerMovement::OnFootstepTraceDone);
+	}
+	CountSceneQuery(EPBSceneQueryKind::Sweep, EPBSceneQuerySite::FloorSample);
+	FootstepTraceHandle = World->AsyncSweepByChannel(
+		EAsyncTraceType::Single,
+		Start,
+		End,
+		FQuat::Identity,
+		UpdatedComponent->GetCollisionObjectType(),
+		GetPawnCapsuleCollisionShape(SHRINK_None),
+		CapsuleParams,
+		ResponseParam,
+		&FootstepTraceDelegate
+	);
+}
+
+void UPBPlayerMovement::OnFootstepTraceDone(const FTraceHandle& TraceHandle, FTraceDatum& TraceDatum)
+{
+	if (TraceHandle != FootstepTraceHandle)
+	{
+		return;
+	}
+	FootstepTraceHandle = FTraceHandle();
+
+	const FHitResult* Hit = FHitResult::GetFirstBlockingHit(TraceDatum.OutHits);
+	FootstepSurfaceType = Hit && Hit->PhysMaterial.IsValid() ? UPhysicalMaterial::DetermineSurfaceType(Hit->PhysMaterial.Get()) : SurfaceType_Default;
+	FootstepSurfaceFrame = GFrameCounter;
+	bHasFootstepSurface = true;
+}
+
+EPhysicalSurface UPBPlayerMovement::GetFloorSurface()
+{
+	// The server tells simulated proxies where they stand, no need to trace
+	if (PBCharacter && CharacterOwner->GetLocalRole() == ROLE_SimulatedProxy)
+	{
+		return PBCharacter->GetReplicatedFloorSurface();
+	}
+
+	if (UsesFloorHitMaterial())
+	{
+		return UPhysicalMaterial::DetermineSurfaceType(CurrentFloor.HitResult.PhysMaterial.Get());
+	}
+
+	const FPBFloorSample& Floor = GetFloorSample();
+	return Floor.PhysMaterial.IsValid() ? Floor.SurfaceType : SurfaceType_Default;
+}
+
+bool UPBPlayerMovement::UsesFloorHitMaterial() const
+{
+	// Simple collision always returns a material, the engine default one when the mesh only sets them on its sections
+	return bUseFloorHitForSurfaceFriction
+		&& IsMovingOnGround()
+		&& CurrentFloor.IsWalkableFloor()
+		&& CurrentFloor.HitResult.PhysMaterial.IsValid()
+		&& CurrentFloor.HitResult.PhysMaterial.Get() != GEngine->DefaultPhysMaterial;
+}
+
+EPhysicalSurface UPBPlayerMovement::GetFootstepSurface()
+{
+	// The trace sent ahead of this step, if it came back in time
+	if (bUseAsyncFootstepTrace && !UsesFloorHitMaterial() && bHasFootstepSurface && GFrameCounter - FootstepSurfaceFrame <= 1)
+	{
+		bHasFootstepSurface = false;
+		return FootstepSurfaceType;
+	}
+	bHasFootstepSurface = false;
+
+	return GetFloorSurface();
+}
+
+const FPBFloorSample& UPBPlayerMovement::GetFloorSample()
+{
+	const FVector PawnLocation = UpdatedComponent->GetComponentLocation();
+	if (FloorSample.bValid && FloorSample.FrameNumber == GFrameCounter && FVector::PointsAreSame(FloorSample.Location, PawnLocation))
+	{
+		INC_DWORD_STAT(STAT_CharFloorSampleCacheHit);
+		return FloorSample;
+	}
+	INC_DWORD_STAT(STAT_CharFloorSampleCacheMiss);
+
+	FloorSample.FrameNumber = GFrameCounter;
+	FloorSample.Location = PawnLocation;
+	FloorSample.Hit.Reset(1.0f, false);
+	TraceCharacterFloor(FloorSample.Hit);
+	FloorSample.PhysMaterial = FloorSample.Hit.PhysMaterial;
+	FloorSample.SurfaceType = UPhysicalMaterial::DetermineSurfaceType(FloorSample.PhysMaterial.Get());
+	FloorSample.Friction = GetFrictionFromHit(FloorSample.Hit);
+	FloorSample.bValid = true;
+	return FloorSample;
+}
+
 void UPBPlayerMovement::OnMovementModeChanged(EMovementMode PreviousMovementMode, uint8 PreviousCustomMode)
 {
 	// Reset step side if we are changing modes
@@ -509,26 +769,33 @@ void UPBPlayerMovement::OnMovementModeChanged(EMovementMode PreviousMovementMode
 	if (PreviousMovementMode == MOVE_Walking && MovementMode == MOVE_Falling)
 	{
 		bJumped = true;
+	}
 
-		// Reset coyote time window
-		CoyoteTimeElapsed = 0.0f;
+	// Coyote time only starts when leaving the ground, it has no meaning anywhere else
+	CoyoteStartTime = bJumped ? SimulationTime : -INFINITY;
+
+	// Landing starts the braking window, we don't brake in the air
+	if (IsMovingOnGround() && PreviousMovementMode != MOVE_Walking && PreviousMovementMode != MOVE_NavWalking)
+	{
+		GroundedStartTime = SimulationTime;
 	}
 
 	if (PreviousMovementMode == MOVE_Custom && PreviousCustomMode == MOVECUSTOM_Ladder) 
 	{
 		if (bAllowRegrabLadder) {
-			LadderRegrabTimeElapsed = 0.f;
+			LadderRegrabStartTime = SimulationTime;
 			RegrabbableLadderData = LadderData;
 		}
 		else {
-			LadderRegrabTimeElapsed = INFINITY;
 			RegrabbableLadderData.Reset();
 		}
 	}
 
-	FHitResult Hit;
-	TraceCharacterFloor(Hit);
-	PlayJumpSound(Hit, bJumped);
+	// Only look for the floor surface if someone can hear the sound
+	if (CanPlayMoveSounds())
+	{
+		PlayJumpSound(GetFloorSurface(), bJumped);
+	}
 
 	Super::OnMovementModeChanged(PreviousMovementMode, PreviousCustomMode);
 }
@@ -649,6 +916,23 @@ FVector UPBPlayerMovement::NewFallVelocity(const FVector& InitialVelocity, const
 void UPBPlayerMovement::UpdateCharacterStateBeforeMovement(float DeltaSeconds)
 {
 	Super::UpdateCharacterStateBeforeMovement(DeltaSeconds);
+	// Every move advances our clock, so timers are evaluated against the moves and not the frames
+	SimulationTime += DeltaSeconds;
+
+	// Ladder regrab window is over, regrab the ladder we slipped off if we are still on it.
+	// If we are not, then remove the potential ladder data.
+	if (RegrabbableLadderData.IsSet() && !IsOnLadder() && !FMath::IsNearlyZero(GrabSameLadderCooldown) && GetSimulationTimeSince(LadderRegrabStartTime) >= GrabSameLadderCooldown)
+	{
+		if (IsValid(RegrabbableLadderData->Target) && OverlapsLadder(RegrabbableLadderData.GetValue()))
+		{
+			GrabLadder(RegrabbableLadderData.GetValue());
+		}
+		else
+		{
+			RegrabbableLadderData.Reset();
+		}
+	}
+
 	Velocity.Z = FMath::Clamp(Velocity.Z, -AxisSpeedLimit, AxisSpeedLimit);
 	UpdateCrouching(DeltaSeconds);
 
@@ -660,15 +944,38 @@ void UPBPlayerMovement::UpdateCharacterStateAfterMovement(float DeltaSeconds)
 	Velocity.Z = FMath::Clamp(Velocity.Z, -AxisSpeedLimit, AxisSpeedLimit);
 	UpdateSurfaceFriction();
 	UpdateCrouching(DeltaSeconds, true);
+
+	// Simulated proxies play the crouch transition from this
+	if (PBCharacter && CharacterOwner->HasAuthority())
+	{
+		PBCharacter->SetReplicatedCrouchAlpha(GetCrouchAlpha());
+	}
 }
 
 void UPBPlayerMovement::UpdateSurfaceFriction(bool bIsSliding)
 {
 	if (!IsFalling() && CurrentFloor.IsWalkableFloor())
 	{
-		FHitResult Hit;
-		TraceCharacterFloor(Hit);
-		SurfaceFriction = GetFrictionFromHit(Hit);
+		const UPhysicalMaterial* FloorMaterial;
+		if (UsesFloorHitMaterial())
+		{
+			// FindFloor already gave us the simple collision material, no need to sweep again
+			SurfaceFriction = GetFrictionFromHit(CurrentFloor.HitResult);
+			FloorMaterial = CurrentFloor.HitResult.PhysMaterial.Get();
+		}
+		else
+		{
+			// Fall back to a complex trace to get the mesh physical material
+			const FPBFloorSample& Floor = GetFloorSample();
+			SurfaceFriction = Floor.Friction;
+			FloorMaterial = Floor.PhysMaterial.Get();
+		}
+
+		// Simulated proxies play their footsteps on the surface we found, resolved like GetFloorSurface does for the owner
+		if (PBCharacter && CharacterOwner->HasAuthority())
+		{
+			PBCharacter->SetReplicatedFloorSurface(FloorMaterial ? UPhysicalMaterial::DetermineSurfaceType(FloorMaterial) : SurfaceType_Default);
+		}
 	}
 	else
 	{
@@ -731,18 +1038,42 @@ void UPBPlayerMovement::UpdateCrouching(float DeltaTime, bool bOnlyUncrouch)
 	}
 }
 
-UPBMoveStepSound* UPBPlayerMovement::GetMoveStepSoundBySurface(EPhysicalSurface SurfaceType) const
+void UPBPlayerMovement::UpdateProxyCrouching(float DeltaTime)
 {
-	TSubclassOf<UPBMoveStepSound>* GotSound = PBCharacter->GetMoveStepSound(TEnumAsByte<EPhysicalSurface>(SurfaceType));
+	if (!PBCharacter)
+	{
+		return;
+	}
 
-	if (GotSound)
+	// Already there, within the precision of the replicated progress
+	const float ServerAlpha = PBCharacter->GetReplicatedCrouchAlpha();
+	const float CurrentAlpha = GetCrouchAlpha();
+	if (FMath::IsNearlyEqual(CurrentAlpha, ServerAlpha, 0.5f / 255.0f))
 	{
-		return GotSound->GetDefaultObject();
+		return;
 	}
 
-	return nullptr;
+	if (ServerAlpha > CurrentAlpha)
+	{
+		DoCrouchResize(IsWalking() ? CrouchTime : CrouchJumpTime, DeltaTime, true);
+	}
+	else
+	{
+		DoUnCrouchResize(IsWalking() ? UncrouchTime : UncrouchJumpTime, DeltaTime, true);
+	}
 }
 
+bool UPBPlayerMovement::CanPlayMoveSounds() const
+{
+	if (!bShouldPlayMoveSounds || IsNetMode(NM_DedicatedServer))
+	{
+		return false;
+	}
+
+	// No audio device means no listener (e.g. -nosound or headless clients)
+	const UWorld* World = GetWorld();
+	return World && World->GetAudioDeviceRaw() != nullptr;
+}
 
 void UPBPlayerMovement::PlayMoveSound(const float DeltaTime)
 {
@@ -760,6 +1091,11 @@ void UPBPlayerMovement::PlayMoveSound(const float DeltaTime)
 	// Check if it's time to play the sound
 	if (MoveSoundTime > 0.0f)
 	{
+		// Look for the surface of the next step now if it is due next frame, so the result is there when we need it
+		if (bUseAsyncFootstepTrace && MoveSoundTime <= 1000.0f * DeltaTime && IsBrakingWindowTolerated() && !IsOnLadder() && CharacterOwner->GetLocalRole() != ROLE_SimulatedProxy && !UsesFloorHitMaterial())
+		{
+			RequestFootstepTrace();
+		}
 		return;
 	}
 
@@ -780,7 +1116,7 @@ void UPBPlayerMovement::PlayMoveSound(const float DeltaTime)
 
 	// Only play sounds if we are moving fast enough on the ground or on a
 	// ladder
-	const bool bPlaySound = (bBrakingWindowElapsed || IsOnLadder()) && Speed >= RunSpeedThreshold * RunSpeedThreshold;
+	const bool bPlaySound = (IsBrakingWindowTolerated() || IsOnLadder()) && Speed >= RunSpeedThreshold * RunSpeedThreshold;
 
 	if (!bPlaySound)
 	{
@@ -791,33 +1127,30 @@ void UPBPlayerMovement::PlayMoveSound(const float DeltaTime)
 
 	float MoveSoundVolume = 0.f;
 
-	UPBMoveStepSound* MoveSound = nullptr;
+	const FPBMoveStepSoundSet* SoundSet = nullptr;
+	EPhysicalSurface SoundSurface = SurfaceType_Default;
 
 	if (IsOnLadder())
 	{
 		MoveSoundVolume = 0.5f;
 		MoveSoundTime = 450.0f;
-		MoveSound = GetMoveStepSoundBySurface(SurfaceType1);
+		SoundSurface = SurfaceType1;
+		SoundSet = &PBCharacter->GetMoveStepSoundSet(SoundSurface);
+		if (!SoundSet->bHasSurfaceSounds)
+		{
+			return;
+		}
 	}
 	else
 	{
 		MoveSoundTime = bSprinting ? 300.0f : 400.0f;
-		FHitResult Hit;
-		TraceCharacterFloor(Hit);
-
-		if (Hit.PhysMaterial.IsValid())
-		{
-			MoveSound = GetMoveStepSoundBySurface(Hit.PhysMaterial->SurfaceType);
-		}
-		if (!MoveSound)
-		{
-			MoveSound = GetMoveStepSoundBySurface(SurfaceType_Default);
-		}
+		SoundSurface = GetFootstepSurface();
+		SoundSet = &PBCharacter->GetMoveStepSoundSet(SoundSurface);
 
 		// Double-check that is valid before accessing it
-		if (MoveSound)
+		if (SoundSet->MoveStepSound)
 		{
-			MoveSoundVolume = bSprinting ? MoveSound->GetSprintVolume() : MoveSound->GetWalkVolume();
+			MoveSoundVolume = bSprinting ? SoundSet->MoveStepSound->GetSprintVolume() : SoundSet->MoveStepSound->GetWalkVolume();
 
 			if (IsCrouching())
 			{
@@ -827,92 +1160,35 @@ void UPBPlayerMovement::PlayMoveSound(const float DeltaTime)
 		}
 	}
 
-	if (MoveSound)
+	if (SoundSet->MoveStepSound)
 	{
-		TArray<USoundCue*> MoveSoundCues;
-
-		if (bSprinting && !IsOnLadder())
-		{
-			MoveSoundCues = StepSide ? MoveSound->GetSprintLeftSounds() : MoveSound->GetSprintRightSounds();
-		}
-		if (!bSprinting || IsOnLadder() || MoveSoundCues.Num() < 1)
-		{
-			MoveSoundCues = StepSide ? MoveSound->GetStepLeftSounds() : MoveSound->GetStepRightSounds();
-		}
+		// The sound sets already fall back to steps and default surface sounds
+		const TArray<USoundCue*>& MoveSoundCues = bSprinting && !IsOnLadder()
+			? *(StepSide ? SoundSet->SprintLeftSounds : SoundSet->SprintRightSounds)
+			: *(StepSide ? SoundSet->StepLeftSounds : SoundSet->StepRightSounds);
 
 		// Error handling - Sounds not valid
-		if (MoveSoundCues.Num() < 1)	// Sounds array not valid
+		if (MoveSoundCues.Num() < 1)
 		{
-			// Get default sounds
-			MoveSound = GetMoveStepSoundBySurface(SurfaceType_Default);
-
-			if (!MoveSound)
-			{
-				return;
-			}
-
-			if (bSprinting)
-			{
-				// Get default sprint sounds
-				MoveSoundCues = StepSide ? MoveSound->GetSprintLeftSounds() : MoveSound->GetSprintRightSounds();
-			}
-
-			if (!bSprinting || MoveSoundCues.Num() < 1)
-			{
-				// If bSprinting = true, the code enter this IF only if the updated MoveSoundCues with default sprint sounds is not valid (length < 1)
-				// If bSprinting = false, the code enter this IF because the walk sounds are not valid and must try to pick them from the default surface
-				// Get default walk sounds
-				MoveSoundCues = StepSide ? MoveSound->GetStepLeftSounds() : MoveSound->GetStepRightSounds();
-			}
-
-			if (MoveSoundCues.Num() < 1)
-			{
-				// SurfaceType_Default sounds not found, return
-				return;
-			}
+			return;
 		}
 
 		// Sound array is valid, play a sound
-		// If the array has just one element pick that one skipping random
-		USoundCue* Sound = MoveSoundCues[MoveSoundCues.Num() == 1 ? 0 : FMath::RandRange(0, MoveSoundCues.Num() - 1)];
-
-		Sound->VolumeMultiplier = MoveSoundVolume;
-
-		const FVector Location = CharacterOwner->GetActorLocation();
-		const FVector StepLocation(FVector(Location.X, Location.Y, Location.Z - GetCharacterOwner()->GetCapsuleComponent()->GetScaledCapsuleHalfHeight()));
-
-		/*UPBGameplayStatics::SpawnSoundAtLocation(CharacterOwner->GetWorld(), Sound, StepLocation);*/
-		UGameplayStatics::SpawnSoundAtLocation(CharacterOwner->GetWorld(), Sound, StepLocation);
+		QueueFootstepSound(MoveSoundCues, MoveSoundVolume, SoundSurface);
 
 		StepSide = !StepSide;
 	}
 }
 
-void UPBPlayerMovement::PlayJumpSound(const FHitResult& Hit, bool bJumped)
+void UPBPlayerMovement::PlayJumpSound(EPhysicalSurface SurfaceType, bool bJumped)
 {
 	if (!bShouldPlayMoveSounds)
 	{
 		return;
 	}
 
-	UPBMoveStepSound* MoveSound = nullptr;
-	TSubclassOf<UPBMoveStepSound>* GotSound = nullptr;
-	if (Hit.PhysMaterial.IsValid())
-	{
-		GotSound = PBCharacter->GetMoveStepSound(Hit.PhysMaterial->SurfaceType);
-	}
-	if (GotSound)
-	{
-		MoveSound = GotSound->GetDefaultObject();
-	}
-	if (!MoveSound)
-	{
-		if (!PBCharacter->GetMoveStepSound(TEnumAsByte<EPhysicalSurface>(SurfaceType_Default)))
-		{
-			return;
-		}
-		MoveSound = PBCharacter->GetMoveStepSound(TEnumAsByte<EPhysicalSurface>(SurfaceType_Default))->GetDefaultObject();
-	}
+	const FPBMoveStepSoundSet& SoundSet = PBCharacter->GetMoveStepSoundSet(SurfaceType);
+	const UPBMoveStepSound* MoveSound = SoundSet.MoveStepSound;
 
 	if (MoveSound)
 	{
@@ -954,54 +1230,125 @@ void UPBPlayerMovement::PlayJumpSound(const FHitResult& Hit, bool bJumped)
 			return;
 		}
 
-		const TArray<USoundCue*>& MoveSoundCues = bJumped ? MoveSound->GetJumpSounds() : MoveSound->GetLandSounds();
+		const TArray<USoundCue*>& MoveSoundCues = bJumped ? *SoundSet.JumpSounds : *SoundSet.LandSounds;
 
 		if (MoveSoundCues.Num() < 1)
 		{
 			return;
 		}
 
-		// If the array has just one element pick that one skipping random
-		USoundCue* Sound = MoveSoundCues[MoveSoundCues.Num() == 1 ? 0 : FMath::RandRange(0, MoveSoundCues.Num() - 1)];
-
-		Sound->VolumeMultiplier = MoveSoundVolume;
-		const FVector Location = CharacterOwner->GetActorLocation();
-		const FVector StepLocation(Location.X, Location.Y, Location.Z - GetCharacterOwner()->GetCapsuleComponent()->GetScaledCapsuleHalfHeight());
-		/*UPBGameplayStatics::SpawnSoundAtLocation(CharacterOwner->GetWorld(), Sound, StepLocation);*/
-		UGameplayStatics::SpawnSoundAtLocation(CharacterOwner->GetWorld(), Sound, StepLocation);
+		QueueFootstepSound(MoveSoundCues, MoveSoundVolume, SurfaceType);
 	}
 }
 
-void UPBPlayerMovement::PhysFalling(float deltaTime, int32 Iterations)
+void UPBPlayerMovement::QueueFootstepSound(const TArray<USoundCue*>& Sounds, float VolumeMultiplier, EPhysicalSurface SurfaceType)
 {
-	SCOPE_CYCLE_COUNTER(STAT_CharPhysFalling);
-	CSV_SCOPED_TIMING_STAT_EXCLUSIVE(CharPhysFalling);
+	const FVector Location = CharacterOwner->GetActorLocation();
+	const FVector StepLocation(Location.X, Location.Y, Location.Z - GetCharacterOwner()->GetCapsuleComponent()->GetScaledCapsuleHalfHeight());
 
-	if (deltaTime < MIN_TICK_TIME)
+	USoundCue* Sound = UPBMoveStepSound::PickSound(Sounds);
+
+	// Let the world decide which footsteps are worth playing this frame
+	if (UPBFootstepSubsystem* FootstepSubsystem = GetWorld()->GetSubsystem<UPBFootstepSubsystem>())
 	{
+		FootstepSubsystem->QueueFootstep(this, Sound, VolumeMultiplier, StepLocation, SurfaceType);
 		return;
 	}
 
-	FVector FallAcceleration = GetFallingLateralAcceleration(deltaTime);
-	FallAcceleration.Z = 0.f;
-	const bool bHasLimitedAirControl = ShouldLimitAirControl(deltaTime, FallAcceleration);
+	PlayFootstepSound(Sound, VolumeMultiplier, StepLocation);
+}
 
-	float remainingTime = deltaTime;
-	while( (remainingTime >= MIN_TICK_TIME) && (Iterations < MaxSimulationIterations) )
+void UPBPlayerMovement::PlayFootstepSound(USoundCue* Sound, float VolumeMultiplier, const FVector& Location)
+{
+	UAudioComponent* AudioComponent = Sound ? GetFootstepAudioComponent() : nullptr;
+	if (!AudioComponent)
 	{
-		Iterations++;
-		float timeTick = GetSimulationTimeStep(remainingTime, Iterations);
-		remainingTime -= timeTick;
-		
-		const FVector OldLocation = UpdatedComponent->GetComponentLocation();
-		const FQuat PawnRotation = UpdatedComponent->GetComponentQuat();
-		bJustTeleported = false;
-
-		const FVector OldVelocityWithRootMotion = Velocity;
+		return;
+	}
 
-		RestorePreAdditiveRootMotionVelocity();
+	AudioComponent->SetWorldLocation(Location);
+	AudioComponent->SetSound(Sound);
+	// Volume is per play, the cue is shared by everyone
+	AudioComponent->SetVolumeMultiplier(VolumeMultiplier);
+	AudioComponent->Play();
+}
 
-		const FVector OldVelocity = Velocity;
+UAudioComponent* UPBPlayerMovement::GetFootstepAudioComponent()
+{
+	// Prefer an idle component, starting from the one played the longest ago
+	const int32 NumComponents = FootstepAudioComponents.Num();
+	for (int32 Offset = 0; Offset < NumComponents; ++Offset)
+	{
+		const int32 Index = (NextFootstepAudioComponent + Offset) % NumComponents;
+		UAudioComponent* AudioComponent = FootstepAudioComponents[Index];
+		if (IsValid(AudioComponent) && !AudioComponent->IsPlaying())
+		{
+			NextFootstepAudioComponent = (Index + 1) % NumComponents;
+			return AudioComponent;
+		}
+	}
+
+	if (NumComponents < FMath::Max(MaxFootstepAudioComponents, 1))
+	{
+		UAudioComponent* AudioComponent = NewObject<UAudioComponent>(CharacterOwner, NAME_None, RF_Transient);
+		AudioComponent->bAutoActivate = false;
+		AudioComponent->bAutoDestroy = false;
+		AudioComponent->bStopWhenOwnerDestroyed = true;
+		// Not attached to anything, steps stay where they were made
+		AudioComponent->SetUsingAbsoluteLocation(true);
+		AudioComponent->RegisterComponent();
+		// Goes right before the oldest one in the round robin, so the cursor still points at the oldest sound
+		const int32 Index = NumComponents > 0 ? NextFootstepAudioComponent % NumComponents : 0;
+		FootstepAudioComponents.Insert(AudioComponent, Index);
+		NextFootstepAudioComponent = (Index + 1) % (NumComponents + 1);
+		return AudioComponent;
+	}
+
+	// Everything is playing, cut off the oldest sound
+	const int32 Index = NextFootstepAudioComponent % NumComponents;
+	NextFootstepAudioComponent = (Index + 1) % NumComponents;
+	if (!IsValid(FootstepAudioComponents[Index]))
+	{
+		FootstepAudioComponents.RemoveAt(Index);
+		return GetFootstepAudioComponent();
+	}
+	return FootstepAudioComponents[Index];
+}
+
+void UPBPlayerMovement::PhysFalling(float deltaTime, int32 Iterations)
+{
+	SCOPE_CYCLE_COUNTER(STAT_CharPhysFalling);
+	CSV_SCOPED_TIMING_STAT_EXCLUSIVE(CharPhysFalling);
+
+	if (deltaTime < MIN_TICK_TIME)
+	{
+		return;
+	}
+
+	// Snapshot what we can hit this tick, for the hemisphere probe in MoveUpdatedComponentImpl
+	GatherLocalGeometry(deltaTime);
+
+	FVector FallAcceleration = GetFallingLateralAcceleration(deltaTime);
+	FallAcceleration.Z = 0.f;
+	const bool bHasLimitedAirControl = ShouldLimitAirControl(deltaTime, FallAcceleration);
+
+	float remainingTime = deltaTime;
+	while( (remainingTime >= MIN_TICK_TIME) && (Iterations < MaxSimulationIterations) )
+	{
+		Iterations++;
+		float timeTick = GetSimulationTimeStep(remainingTime, Iterations);
+		remainingTime -= timeTick;
+
+
+		const FVector OldLocation = UpdatedComponent->GetComponentLocation();
+		const FQuat PawnRotation = UpdatedComponent->GetComponentQuat();
+		bJustTeleported = false;
+
+		const FVector OldVelocityWithRootMotion = Velocity;
+
+		RestorePreAdditiveRootMotionVelocity();
+
+		const FVector OldVelocity = Velocity;
 
 		// Apply input
 		const float MaxDecel = GetMaxBrakingDeceleration();
@@ -1108,8 +1455,13 @@ void UPBPlayerMovement::PhysFalling(float deltaTime, int32 Iterations)
 		}
 		else if ( Hit.bBlockingHit )
 		{
+			// The landing checks below may find the floor several times from the same spot, share the results between them only
+			FloorMemo.bValid = false;
+			bMemoizeFindFloor = true;
+
 			if (IsValidLandingSpot(UpdatedComponent->GetComponentLocation(), Hit))
 			{
+				bMemoizeFindFloor = false;
 				remainingTime += subTimeTickRemaining;
 				ProcessLanded(Hit, remainingTime, Iterations);
 				return;
@@ -1129,11 +1481,13 @@ void UPBPlayerMovement::PhysFalling(float deltaTime, int32 Iterations)
 					FindFloor(PawnLocation, FloorResult, false);
 					if (FloorResult.IsWalkableFloor() && IsValidLandingSpot(PawnLocation, FloorResult.HitResult))
 					{
+						bMemoizeFindFloor = false;
 						remainingTime += subTimeTickRemaining;
 						ProcessLanded(FloorResult.HitResult, remainingTime, Iterations);
 						return;
 					}
 				}
+				bMemoizeFindFloor = false;
 
 				HandleImpact(Hit, LastMoveTimeSlice, Adjusted);
 				
@@ -1347,9 +1701,16 @@ void UPBPlayerMovement::PhysLadder(float deltaTime, int32 Iterations)
 		}
 	}
 
-	// Find floor
-	bool bUseCachedFloor = FVector::PointsAreSame(UpdatedComponent->GetComponentLocation(), OldLocation);
-	FindFloor(UpdatedComponent->GetComponentLocation(), CurrentFloor, bUseCachedFloor, NULL);
+	// Find floor, only if we are close enough to a dismount to reach it
+	if (IsNearLadderDismount())
+	{
+		bool bUseCachedFloor = FVector::PointsAreSame(UpdatedComponent->GetComponentLocation(), OldLocation);
+		FindFloor(UpdatedComponent->GetComponentLocation(), CurrentFloor, bUseCachedFloor, NULL);
+	}
+	else
+	{
+		CurrentFloor.Clear();
+	}
 	// If it is walkabke and not the ladder, try to get off the ladder at this position
 	if (CurrentFloor.IsWalkableFloor() && CurrentFloor.HitResult.Component != LadderData->Target)
 	{
@@ -1379,12 +1740,138 @@ bool UPBPlayerMovement::OverlapsLadder(const FLadderData& Ladder)
 	UCapsuleComponent* CharacterCapsule = CharacterOwner->GetCapsuleComponent();
 	if (!CharacterCapsule) { return false; }
 
+	// Registered ladders are tested against their cached oriented bounds, without any scene query
+	if (UPBLadderSubsystem* LadderSubsystem = GetWorld()->GetSubsystem<UPBLadderSubsystem>()) {
+		if (const FPBLadderBounds* Bounds = LadderSubsystem->FindLadder(Ladder.Target)) {
+			return Bounds->OverlapsCapsule(
+				CharacterCapsule->GetComponentLocation(),
+				CharacterCapsule->GetComponentQuat(),
+				CharacterCapsule->GetScaledCapsuleRadius(),
+				CharacterCapsule->GetScaledCapsuleHalfHeight());
+		}
+	}
+
+	CountSceneQuery(EPBSceneQueryKind::Overlap, EPBSceneQuerySite::Ladder);
 	return Ladder.Target->OverlapComponent(
 		CharacterCapsule->GetComponentLocation(),
 		CharacterCapsule->GetComponentQuat(),
 		CharacterCapsule->GetCollisionShape());
 }
 
+bool UPBPlayerMovement::FindOverlappedLadder(FLadderData& OutLadder)
+{
+	if (!CharacterOwner) { return false; }
+	UCapsuleComponent* CharacterCapsule = CharacterOwner->GetCapsuleComponent();
+	UPBLadderSubsystem* LadderSubsystem = GetWorld()->GetSubsystem<UPBLadderSubsystem>();
+	if (!CharacterCapsule || !LadderSubsystem) { return false; }
+
+	const FVector CapsuleLocation = CharacterCapsule->GetComponentLocation();
+	UPrimitiveComponent* Ladder = LadderSubsystem->FindOverlappingLadder(
+		CapsuleLocation,
+		CharacterCapsule->GetComponentQuat(),
+		CharacterCapsule->GetScaledCapsuleRadius(),
+		CharacterCapsule->GetScaledCapsuleHalfHeight());
+	const FPBLadderBounds* Bounds = Ladder ? LadderSubsystem->FindLadder(Ladder) : nullptr;
+	if (!Bounds) { return false; }
+
+	// Same data as a grab from the overlap event, which gets the normal of the side we touched
+	OutLadder.Target = Ladder;
+	OutLadder.Up = Ladder->GetUpVector();
+	OutLadder.Normal = ((CapsuleLocation - Bounds->Center) | Bounds->Normal) >= 0.0f ? Bounds->Normal : -Bounds->Normal;
+	OutLadder.Right = OutLadder.Normal ^ OutLadder.Up;
+	return true;
+}
+
+void UPBPlayerMovement::ComputeLadderDismounts(const FLadderData& Ladder)
+{
+	LadderDismounts.Reset();
+	bHasLadderDismounts = false;
+
+	UPBLadderSubsystem* LadderSubsystem = GetWorld()->GetSubsystem<UPBLadderSubsystem>();
+	const FPBLadderBounds* Bounds = LadderSubsystem ? LadderSubsystem->FindLadder(Ladder.Target) : nullptr;
+	if (!Bounds || !CharacterOwner)
+	{
+		// Unknown ladder, we'll look for the floor every tick
+		return;
+	}
+
+	float PawnRadius, PawnHalfHeight;
+	CharacterOwner->GetCapsuleComponent()->GetScaledCapsuleSize(PawnRadius, PawnHalfHeight);
+	const FVector PawnLocation = UpdatedComponent->GetComponentLocation();
+	const FQuat PawnRotation = UpdatedComponent->GetComponentQuat();
+
+	// Half length of the ladder box projected on the climbing direction
+	const float LadderHalfLength = FMath::Abs(Bounds->Extent.X * (Bounds->Normal | Ladder.Up))
+								 + FMath::Abs(Bounds->Extent.Y * (Bounds->Right | Ladder.Up))
+								 + FMath::Abs(Bounds->Extent.Z * (Bounds->Up | Ladder.Up));
+	LadderDismountOrigin = Bounds->Center;
+	const float PawnCoord = (PawnLocation - LadderDismountOrigin) | Ladder.Up;
+	// FindFloor reaches the floor from this far above it (MaxStepHeight is reset to default on ladders)
+	const float FloorReach = FMath::Max(MaxStepHeight, DefaultStepHeight) + MAX_FLOOR_DIST;
+	// Search this far around the ends of the ladder for a landing
+	const float SearchDist = FloorReach + PawnHalfHeight;
+
+	FCollisionQueryParams CapsuleParams(SCENE_QUERY_STAT(LadderDismountTrace), false, CharacterOwner);
+	FCollisionResponseParams ResponseParam;
+	InitCollisionParams(CapsuleParams, ResponseParam);
+	CapsuleParams.AddIgnoredComponent(Ladder.Target);
+	const FCollisionShape CapsuleShape = GetPawnCapsuleCollisionShape(SHRINK_None);
+	const ECollisionChannel CollisionChannel = UpdatedComponent->GetCollisionObjectType();
+
+	for (const float EndCoord : { -LadderHalfLength, LadderHalfLength })
+	{
+		// Sweep down along the ladder, through the area around its end
+		const FVector SearchStart = PawnLocation + Ladder.Up * (EndCoord + SearchDist - PawnCoord);
+		const FVector SearchEnd = PawnLocation + Ladder.Up * (EndCoord - SearchDist - PawnCoord);
+		FPBLadderDismount Dismount;
+		CountSceneQuery(EPBSceneQueryKind::Sweep, EPBSceneQuerySite::Ladder);
+		const bool bBlockingHit = GetWorld()->SweepSingleByChannel(Dismount.FloorHit, SearchStart, SearchEnd, PawnRotation, CollisionChannel, CapsuleShape, CapsuleParams, ResponseParam);
+		if (!bBlockingHit)
+		{
+			continue;
+		}
+
+		if (Dismount.FloorHit.bStartPenetrating)
+		{
+			// Can't tell where the floor is, consider the whole search area
+			Dismount.MinCoord = EndCoord - SearchDist;
+			Dismount.MaxCoord = EndCoord + SearchDist;
+		}
+		else if (IsWalkable(Dismount.FloorHit))
+		{
+			// Coordinate of the capsule resting on the floor, with some margin for strafing along the ladder
+			const float FloorCoord = (Dismount.FloorHit.Location - LadderDismountOrigin) | Ladder.Up;
+			Dismount.MinCoord = FloorCoord - PawnRadius;
+			Dismount.MaxCoord = FloorCoord + FloorReach + PawnRadius;
+		}
+		else
+		{
+			continue;
+		}
+		LadderDismounts.Add(Dismount);
+	}
+
+	bHasLadderDismounts = true;
+}
+
+bool UPBPlayerMovement::IsNearLadderDismount() const
+{
+	if (!bHasLadderDismounts || !LadderData.IsSet())
+	{
+		return true;
+	}
+
+	const float PawnCoord = (UpdatedComponent->GetComponentLocation() - LadderDismountOrigin) | LadderData->Up;
+	for (const FPBLadderDismount& Dismount : LadderDismounts)
+	{
+		if (PawnCoord >= Dismount.MinCoord && PawnCoord <= Dismount.MaxCoord)
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
 float UPBPlayerMovement::ClimbLadder(FVector Delta, FHitResult& Hit)
 {
 	FVector Start = UpdatedComponent->GetComponentLocation();
@@ -1491,12 +1978,17 @@ bool UPBPlayerMovement::CanPowerSlide() const
 
 void UPBPlayerMovement::StartPowerSlide(bool IsBoostedSlide)
 {
+	if (!bIsPowerSliding && PBCharacter)
+	{
+		PBCharacter->NotifyMovementTransition();
+	}
+
 	// We start a powerslide
 	bIsPowerSliding = true;
 
 	// If timer not elapsed, reset timer to avoid spam
-	if (PowerSlidingTimeElapsed <= SlidingBoostCooldown) {
-		PowerSlidingTimeElapsed = 0.f;
+	if (GetSimulationTimeSince(PowerSlideEndTime) <= SlidingBoostCooldown) {
+		PowerSlideEndTime = SimulationTime;
 	}
 	else if (IsBoostedSlide) {
 		Velocity += SlidingSpeedBoost * Acceleration.GetSafeNormal();
@@ -1507,7 +1999,7 @@ void UPBPlayerMovement::EndPowerSlide()
 {
 	// If we were powersliding, start the timer
 	if (bIsPowerSliding) {
-		PowerSlidingTimeElapsed = 0.0f;
+		PowerSlideEndTime = SimulationTime;
 	}
 
 	// We stop the powerslide
@@ -1568,7 +2060,7 @@ void UPBPlayerMovement::CalcVelocity(float DeltaTime, float Friction, bool bFlui
 
 	// Apply braking or deceleration
 	const bool bZeroAcceleration = Acceleration.IsNearlyZero();
-	const bool bIsGroundMove = IsMovingOnGround() && bBrakingWindowElapsed;
+	const bool bIsGroundMove = IsBrakingWindowTolerated();
 
 	// Check if we should start or stop a power slide
 	if (CanPowerSlide()) 
@@ -1802,10 +2294,13 @@ void UPBPlayerMovement::CalcVelocity(float DeltaTime, float Friction, bool bFlui
 
 void UPBPlayerMovement::Crouch(bool bClientSimulation)
 {
-	// TODO: replicate to the client simulation that we are in a crouch transition so they can do the resize too.
 	if (bClientSimulation)
 	{
-		Super::Crouch(true);
+		// Simulated proxies resize toward the replicated crouch progress instead of snapping, see UpdateProxyCrouching
+		if (!PBCharacter || CharacterOwner->GetLocalRole() != ROLE_SimulatedProxy)
+		{
+			Super::Crouch(true);
+		}
 		return;
 	}
 	bIsInCrouchTransition = true;
@@ -1821,6 +2316,14 @@ void UPBPlayerMovement::DoCrouchResize(float TargetTime, float DeltaTime, bool b
 		return;
 	}
 
+	if (bClientSimulation && PBCharacter && CharacterOwner->GetLocalRole() == ROLE_SimulatedProxy)
+	{
+		// Progress toward the server's crouch alpha, without going past it
+		const float ServerAlpha = PBCharacter->GetReplicatedCrouchAlpha();
+		ResizeProxyCapsule(FMath::IsNearlyZero(TargetTime) ? ServerAlpha : FMath::Min(GetCrouchAlpha() + DeltaTime / TargetTime, ServerAlpha));
+		return;
+	}
+
 	// See if collision is already at desired size.
 	UCapsuleComponent* CharacterCapsule = CharacterOwner->GetCapsuleComponent();
 	if (FMath::IsNearlyEqual(CharacterCapsule->GetUnscaledCapsuleHalfHeight(), GetCrouchedHalfHeight()))
@@ -1851,7 +2354,8 @@ void UPBPlayerMovement::DoCrouchResize(float TargetTime, float DeltaTime, bool b
 	const float CurrentUnscaledHalfHeight = CharacterCapsule->GetUnscaledCapsuleHalfHeight();
 	// Determine the crouching progress
 	const bool bInstantCrouch = FMath::IsNearlyZero(TargetTime);
-	const float CurrentAlpha = 1.0f - (CurrentUnscaledHalfHeight - GetCrouchedHalfHeight()) / FullCrouchDiff;
+	const float CurrentAlpha = GetCrouchAlpha();
+	const float CurrentCapsuleAlpha = 1.0f - (CurrentUnscaledHalfHeight - GetCrouchedHalfHeight()) / FullCrouchDiff;
 	// Determine how much we are progressing this tick
 	float TargetAlphaDiff = 1.0f;
 	float TargetAlpha = 1.0f;
@@ -1863,16 +2367,23 @@ void UPBPlayerMovement::DoCrouchResize(float TargetTime, float DeltaTime, bool b
 	if (TargetAlpha >= 1.0f || FMath::IsNearlyEqual(TargetAlpha, 1.0f))
 	{
 		TargetAlpha = 1.0f;
-		TargetAlphaDiff = TargetAlpha - CurrentAlpha;
 		bIsInCrouchTransition = false;
 		CharacterOwner->bIsCrouched = true;
 	}
+	CrouchAlpha = TargetAlpha;
+	// With quantized transitions, the capsule stays at its current step until we reach the next one
+	const float TargetCapsuleAlpha = QuantizeCrouchAlpha(TargetAlpha, true);
+	if (CrouchTransitionSteps > 0 && FMath::IsNearlyEqual(TargetCapsuleAlpha, CurrentCapsuleAlpha))
+	{
+		CharacterOwner->RecalculateBaseEyeHeight();
+		return;
+	}
 	// Determine the target height for this tick
-	float TargetCrouchedHalfHeight = OldUnscaledHalfHeight - FullCrouchDiff * TargetAlpha;
+	float TargetCrouchedHalfHeight = OldUnscaledHalfHeight - FullCrouchDiff * TargetCapsuleAlpha;
 	// Height is not allowed to be smaller than radius.
 	float ClampedCrouchedHalfHeight = FMath::Max3(0.0f, OldUnscaledRadius, TargetCrouchedHalfHeight);
 	CharacterCapsule->SetCapsuleSize(OldUnscaledRadius, ClampedCrouchedHalfHeight);
-	float HalfHeightAdjust = FullCrouchDiff * TargetAlphaDiff;
+	float HalfHeightAdjust = FullCrouchDiff * (TargetCapsuleAlpha - CurrentCapsuleAlpha);
 	float ScaledHalfHeightAdjust = HalfHeightAdjust * ComponentScale;
 
 	if (!bClientSimulation)
@@ -1910,10 +2421,13 @@ void UPBPlayerMovement::DoCrouchResize(float TargetTime, float DeltaTime, bool b
 
 void UPBPlayerMovement::UnCrouch(bool bClientSimulation)
 {
-	// TODO: replicate to the client simulation that we are in a crouch transition so they can do the resize too.
 	if (bClientSimulation)
 	{
-		Super::UnCrouch(true);
+		// Simulated proxies resize toward the replicated crouch progress instead of snapping, see UpdateProxyCrouching
+		if (!PBCharacter || CharacterOwner->GetLocalRole() != ROLE_SimulatedProxy)
+		{
+			Super::UnCrouch(true);
+		}
 		return;
 	}
 	bIsInCrouchTransition = true;
@@ -1929,6 +2443,14 @@ void UPBPlayerMovement::DoUnCrouchResize(float TargetTime, float DeltaTime, bool
 		return;
 	}
 
+	if (bClientSimulation && PBCharacter && CharacterOwner->GetLocalRole() == ROLE_SimulatedProxy)
+	{
+		// Progress toward the server's crouch alpha, without going past it
+		const float ServerAlpha = PBCharacter->GetReplicatedCrouchAlpha();
+		ResizeProxyCapsule(FMath::IsNearlyZero(TargetTime) ? ServerAlpha : FMath::Max(GetCrouchAlpha() - DeltaTime / TargetTime, ServerAlpha));
+		return;
+	}
+
 	ACharacter* DefaultCharacter = CharacterOwner->GetClass()->GetDefaultObject<ACharacter>();
 
 	UCapsuleComponent* CharacterCapsule = CharacterOwner->GetCapsuleComponent();
@@ -1954,11 +2476,15 @@ void UPBPlayerMovement::DoUnCrouchResize(float TargetTime, float DeltaTime, bool
 	const float FullCrouchDiff = UncrouchedHeight - GetCrouchedHalfHeight();
 	// Determine the crouching progress
 	const bool InstantCrouch = FMath::IsNearlyZero(TargetTime);
-	float CurrentAlpha = 1.0f - (UncrouchedHeight - OldUnscaledHalfHeight) / FullCrouchDiff;
+	// Uncrouch progress, the opposite of the crouch alpha
+	float CurrentAlpha = 1.0f - GetCrouchAlpha();
+	const float CurrentCapsuleAlpha = (UncrouchedHeight - OldUnscaledHalfHeight) / FullCrouchDiff;
 	float TargetAlphaDiff = 1.0f;
 	float TargetAlpha = 1.0f;
 	const UWorld* MyWorld = GetWorld();
 	const FVector PawnLocation = UpdatedComponent->GetComponentLocation();
+	// Headroom needed for a full uncrouch, used to measure the ceiling once for any partial uncrouch
+	const float MaxHeadroomRise = 2.0f * (ComponentScale * (UncrouchedHeight - OldUnscaledHalfHeight) + KINDA_SMALL_NUMBER * 10.0f);
 	if (!InstantCrouch)
 	{
 		TargetAlphaDiff = DeltaTime / TargetTime;
@@ -1969,19 +2495,12 @@ void UPBPlayerMovement::DoUnCrouchResize(float TargetTime, float DeltaTime, bool
 			// Try to stay in place and see if the larger capsule fits. We use a
 			// slightly taller capsule to avoid penetration.
 			const float SweepInflation = KINDA_SMALL_NUMBER * 10.0f;
-			FCollisionQueryParams CapsuleParams(SCENE_QUERY_STAT(CrouchTrace), false, CharacterOwner);
-			FCollisionResponseParams ResponseParam;
-			InitCollisionParams(CapsuleParams, ResponseParam);
 
 			// Check how much we have left to go (with some wiggle room to still allow for partial uncrouches in some areas)
 			const float HalfHeightAdjust = ComponentScale * (UncrouchedHeight - OldUnscaledHalfHeight) * GroundUncrouchCheckFactor;
 
-			// Compensate for the difference between current capsule size and standing size
-			// Shrink by negative amount, so actually grow it.
-			const FCollisionShape StandingCapsuleShape = GetPawnCapsuleCollisionShape(SHRINK_HeightCustom, -SweepInflation - HalfHeightAdjust);
-			const ECollisionChannel CollisionChannel = UpdatedComponent->GetCollisionObjectType();
-			FVector StandingLocation = PawnLocation + FVector(0.0f, 0.0f, StandingCapsuleShape.GetCapsuleHalfHeight() - CurrentCrouchedHalfHeight);
-			bool bEncroached = MyWorld->OverlapBlockingTestByChannel(StandingLocation, FQuat::Identity, CollisionChannel, StandingCapsuleShape, CapsuleParams, ResponseParam);
+			// The larger capsule keeps the same base, so it fits if our top can rise by twice the half height difference
+			const bool bEncroached = GetUncrouchHeadroom(MaxHeadroomRise) < 2.0f * (SweepInflation + HalfHeightAdjust);
 			if (bEncroached)
 			{
 				// We're blocked from doing a full uncrouch, so don't attempt for now
@@ -1992,10 +2511,17 @@ void UPBPlayerMovement::DoUnCrouchResize(float TargetTime, float DeltaTime, bool
 	if (TargetAlpha >= 1.0f || FMath::IsNearlyEqual(TargetAlpha, 1.0f))
 	{
 		TargetAlpha = 1.0f;
-		TargetAlphaDiff = TargetAlpha - CurrentAlpha;
 		bIsInCrouchTransition = false;
 	}
-	const float HalfHeightAdjust = FullCrouchDiff * TargetAlphaDiff;
+	// With quantized transitions, the capsule stays at its current step until we reach the next one
+	const float TargetCapsuleAlpha = QuantizeCrouchAlpha(1.0f - TargetAlpha, false);
+	if (CrouchTransitionSteps > 0 && FMath::IsNearlyEqual(TargetCapsuleAlpha, CurrentCapsuleAlpha))
+	{
+		CrouchAlpha = 1.0f - TargetAlpha;
+		CharacterOwner->RecalculateBaseEyeHeight();
+		return;
+	}
+	const float HalfHeightAdjust = FullCrouchDiff * (CurrentCapsuleAlpha - TargetCapsuleAlpha);
 	const float ScaledHalfHeightAdjust = HalfHeightAdjust * ComponentScale;
 
 	// Grow to uncrouched size.
@@ -2020,6 +2546,7 @@ void UPBPlayerMovement::DoUnCrouchResize(float TargetTime, float DeltaTime, bool
 		if (!bCrouchMaintainsBaseLocation)
 		{
 			// Expand in place
+			CountSceneQuery(EPBSceneQueryKind::Overlap, EPBSceneQuerySite::Uncrouch);
 			bEncroached = MyWorld->OverlapBlockingTestByChannel(PawnLocation, FQuat::Identity, CollisionChannel, StandingCapsuleShape, CapsuleParams, ResponseParam);
 
 			if (bEncroached)
@@ -2048,6 +2575,7 @@ void UPBPlayerMovement::DoUnCrouchResize(float TargetTime, float DeltaTime, bool
 						// if we can stand there
 						const float DistanceToBase = (Hit.Time * TraceDist) + ShortCapsuleShape.Capsule.HalfHeight;
 						const FVector NewLoc = FVector(PawnLocation.X, PawnLocation.Y, PawnLocation.Z - DistanceToBase + StandingCapsuleShape.Capsule.HalfHeight + SweepInflation + MIN_FLOOR_DIST / 2.0f);
+						CountSceneQuery(EPBSceneQueryKind::Overlap, EPBSceneQuerySite::Uncrouch);
 						bEncroached = MyWorld->OverlapBlockingTestByChannel(NewLoc, FQuat::Identity, CollisionChannel, StandingCapsuleShape, CapsuleParams, ResponseParam);
 						if (!bEncroached)
 						{
@@ -2065,7 +2593,10 @@ void UPBPlayerMovement::DoUnCrouchResize(float TargetTime, float DeltaTime, bool
 		{
 			// Expand while keeping base location the same.
 			FVector StandingLocation = PawnLocation + FVector(0.0f, 0.0f, StandingCapsuleShape.GetCapsuleHalfHeight() - CurrentCrouchedHalfHeight);
-			bEncroached = MyWorld->OverlapBlockingTestByChannel(StandingLocation, FQuat::Identity, CollisionChannel, StandingCapsuleShape, CapsuleParams, ResponseParam);
+			// Same base, so the larger capsule fits if our top can rise by twice the half height difference
+			const float RequiredRise = 2.0f * (StandingCapsuleShape.GetCapsuleHalfHeight() - CurrentCrouchedHalfHeight);
+			const float Headroom = GetUncrouchHeadroom(MaxHeadroomRise);
+			bEncroached = Headroom < RequiredRise;
 
 			if (bEncroached)
 			{
@@ -2076,8 +2607,10 @@ void UPBPlayerMovement::DoUnCrouchResize(float TargetTime, float DeltaTime, bool
 					const float MinFloorDist = KINDA_SMALL_NUMBER * 10.0f;
 					if (CurrentFloor.bBlockingHit && CurrentFloor.FloorDist > MinFloorDist)
 					{
-						StandingLocation.Z -= CurrentFloor.FloorDist - MinFloorDist;
-						bEncroached = MyWorld->OverlapBlockingTestByChannel(StandingLocation, FQuat::Identity, CollisionChannel, StandingCapsuleShape, CapsuleParams, ResponseParam);
+						// The floor query already tells us there is room below
+						const float LowerDist = CurrentFloor.FloorDist - MinFloorDist;
+						StandingLocation.Z -= LowerDist;
+						bEncroached = Headroom + LowerDist < RequiredRise;
 					}
 				}
 			}
@@ -2102,6 +2635,7 @@ void UPBPlayerMovement::DoUnCrouchResize(float TargetTime, float DeltaTime, bool
 	{
 		bShrinkProxyCapsule = true;
 	}
+	CrouchAlpha = 1.0f - TargetAlpha;
 
 	// Now call SetCapsuleSize() to cause touch/untouch events and actually grow the capsule
 	CharacterCapsule->SetCapsuleSize(DefaultCharacter->GetCapsuleComponent()->GetUnscaledCapsuleRadius(), OldUnscaledHalfHeight + HalfHeightAdjust, true);
@@ -2124,6 +2658,228 @@ void UPBPlayerMovement::DoUnCrouchResize(float TargetTime, float DeltaTime, bool
 	}
 }
 
+float UPBPlayerMovement::GetCapsuleCrouchAlpha() const
+{
+	if (!CharacterOwner)
+	{
+		return 0.0f;
+	}
+	const ACharacter* DefaultCharacter = CharacterOwner->GetClass()->GetDefaultObject<ACharacter>();
+	const float UncrouchedHalfHeight = DefaultCharacter->GetCapsuleComponent()->GetUnscaledCapsuleHalfHeight();
+	const float FullCrouchDiff = UncrouchedHalfHeight - GetCrouchedHalfHeight();
+	if (FMath::IsNearlyZero(FullCrouchDiff))
+	{
+		return 0.0f;
+	}
+	const UCapsuleComponent* CharacterCapsule = CharacterOwner->GetCapsuleComponent();
+	float CapsuleHalfHeight = CharacterCapsule->GetUnscaledCapsuleHalfHeight();
+	// Simulated proxies have a slightly smaller capsule, see AdjustProxyCapsuleSize
+	if (CharacterOwner->GetLocalRole() == ROLE_SimulatedProxy && !bShrinkProxyCapsule && CharacterCapsule->GetShapeScale() > KINDA_SMALL_NUMBER)
+	{
+		CapsuleHalfHeight += FMath::Max(0.0f, NetProxyShrinkHalfHeight) / CharacterCapsule->GetShapeScale();
+	}
+	return (UncrouchedHalfHeight - CapsuleHalfHeight) / FullCrouchDiff;
+}
+
+void UPBPlayerMovement::ResizeProxyCapsule(float NewAlpha)
+{
+	const ACharacter* DefaultCharacter = CharacterOwner->GetClass()->GetDefaultObject<ACharacter>();
+	UCapsuleComponent* CharacterCapsule = CharacterOwner->GetCapsuleComponent();
+	const float UncrouchedHalfHeight = DefaultCharacter->GetCapsuleComponent()->GetUnscaledCapsuleHalfHeight();
+	const float UncrouchedRadius = DefaultCharacter->GetCapsuleComponent()->GetUnscaledCapsuleRadius();
+	const float FullCrouchDiff = UncrouchedHalfHeight - GetCrouchedHalfHeight();
+	const float ComponentScale = CharacterCapsule->GetShapeScale();
+
+	// Like the owner, round the capsule step down when crouching and up when uncrouching
+	const float CurrentCapsuleAlpha = GetCapsuleCrouchAlpha();
+	const float TargetCapsuleAlpha = QuantizeCrouchAlpha(NewAlpha, NewAlpha >= GetCrouchAlpha());
+	CrouchAlpha = NewAlpha;
+	if (FMath::IsNearlyEqual(TargetCapsuleAlpha, CurrentCapsuleAlpha))
+	{
+		CharacterOwner->RecalculateBaseEyeHeight();
+		return;
+	}
+
+	// Resize from the full size capsule, the proxy shrink is applied again afterwards
+	const float TargetHalfHeight = FMath::Max3(0.0f, UncrouchedRadius, UncrouchedHalfHeight - FullCrouchDiff * TargetCapsuleAlpha);
+	CharacterCapsule->SetCapsuleSize(UncrouchedRadius, TargetHalfHeight, true);
+	bShrinkProxyCapsule = true;
+	AdjustProxyCapsuleSize();
+
+	// The crouch events only fire when we start or finish crouching, the steps in between only move the mesh
+	const float MeshAdjust = UncrouchedHalfHeight - TargetHalfHeight;
+	const bool bWasCrouched = CurrentCapsuleAlpha > 0.0f;
+	const bool bIsCrouched = TargetCapsuleAlpha > 0.0f;
+	if (bIsCrouched && !bWasCrouched)
+	{
+		CharacterOwner->OnStartCrouch(MeshAdjust, MeshAdjust * ComponentScale);
+	}
+	else if (!bIsCrouched && bWasCrouched)
+	{
+		CharacterOwner->OnEndCrouch(MeshAdjust, MeshAdjust * ComponentScale);
+	}
+	else
+	{
+		PBCharacter->AdjustCrouchedMesh(MeshAdjust);
+	}
+
+	// Don't smooth this change in mesh position
+	FNetworkPredictionData_Client_Character* ClientData = GetPredictionData_Client_Character();
+	if (ClientData)
+	{
+		const float ScaledHalfHeightAdjust = FullCrouchDiff * (TargetCapsuleAlpha - CurrentCapsuleAlpha) * ComponentScale;
+		ClientData->MeshTranslationOffset -= FVector(0.0f, 0.0f, ScaledHalfHeightAdjust);
+		ClientData->OriginalMeshTranslationOffset = ClientData->MeshTranslationOffset;
+	}
+}
+
+float UPBPlayerMovement::QuantizeCrouchAlpha(float Alpha, bool bRoundDown) const
+{
+	if (CrouchTransitionSteps <= 0 || Alpha <= 0.0f || Alpha >= 1.0f)
+	{
+		return Alpha;
+	}
+	// N intermediate heights split the transition in N + 1 intervals
+	const float Intervals = CrouchTransitionSteps + 1;
+	return (bRoundDown ? FMath::FloorToFloat(Alpha * Intervals) : FMath::CeilToFloat(Alpha * Intervals)) / Intervals;
+}
+
+float UPBPlayerMovement::GetCrouchAlpha() const
+{
+	const float CapsuleAlpha = GetCapsuleCrouchAlpha();
+	// Our progress is only valid while the capsule is still at its step, anything else resizing the capsule (replication, teleports) overrides it
+	if (CrouchTransitionSteps > 0 && (FMath::IsNearlyEqual(QuantizeCrouchAlpha(CrouchAlpha, true), CapsuleAlpha) || FMath::IsNearlyEqual(QuantizeCrouchAlpha(CrouchAlpha, false), CapsuleAlpha)))
+	{
+		return CrouchAlpha;
+	}
+	return CapsuleAlpha;
+}
+
+float UPBPlayerMovement::GetCrouchEyeHeightOffset() const
+{
+	if (CrouchTransitionSteps <= 0 || !CharacterOwner)
+	{
+		return 0.0f;
+	}
+	const ACharacter* DefaultCharacter = CharacterOwner->GetClass()->GetDefaultObject<ACharacter>();
+	const float FullCrouchDiff = DefaultCharacter->GetCapsuleComponent()->GetUnscaledCapsuleHalfHeight() - GetCrouchedHalfHeight();
+	// Distance between the center of the capsule and where it would be without quantization
+	const float CenterOffset = (GetCrouchAlpha() - GetCapsuleCrouchAlpha()) * FullCrouchDiff * CharacterOwner->GetCapsuleComponent()->GetShapeScale();
+	// The base stays in place on the ground, the top in the air
+	return bCrouchMaintainsBaseLocation ? -CenterOffset : CenterOffset;
+}
+
+float UPBPlayerMovement::GetUncrouchHeadroom(float MaxRise)
+{
+	const UCapsuleComponent* CharacterCapsule = CharacterOwner->GetCapsuleComponent();
+	const FVector PawnLocation = UpdatedComponent->GetComponentLocation();
+	const float PawnHalfHeight = CharacterCapsule->GetScaledCapsuleHalfHeight();
+
+	// Reuse the last measure if we haven't moved and what blocked us is still in place
+	if (HeadroomCache.bValid && HeadroomCache.MaxRise >= MaxRise && FVector::PointsAreSame(HeadroomCache.Location, PawnLocation) && FMath::IsNearlyEqual(HeadroomCache.HalfHeight, PawnHalfHeight))
+	{
+		const UPrimitiveComponent* Blocker = HeadroomCache.Blocker.Get();
+		if (Blocker && Blocker->GetComponentTransform().Equals(HeadroomCache.BlockerTransform))
+		{
+			return HeadroomCache.Headroom;
+		}
+	}
+
+	FCollisionQueryParams CapsuleParams(SCENE_QUERY_STAT(CrouchTrace), false, CharacterOwner);
+	FCollisionResponseParams ResponseParam;
+	InitCollisionParams(CapsuleParams, ResponseParam);
+	const FCollisionShape CapsuleShape = GetPawnCapsuleCollisionShape(SHRINK_None);
+	const ECollisionChannel CollisionChannel = UpdatedComponent->GetCollisionObjectType();
+
+	// Sweeping our capsule up covers the same space as a taller capsule with the same base
+	FHitResult Hit(1.0f);
+	CountSceneQuery(EPBSceneQueryKind::Sweep, EPBSceneQuerySite::Uncrouch);
+	const bool bBlockingHit = GetWorld()->SweepSingleByChannel(Hit, PawnLocation, PawnLocation + FVector(0.0f, 0.0f, MaxRise), FQuat::Identity, CollisionChannel, CapsuleShape, CapsuleParams, ResponseParam);
+	const float Headroom = !bBlockingHit ? MaxRise : (Hit.bStartPenetrating ? 0.0f : Hit.Time * MaxRise);
+
+	// Only cache blocked results, an unblocked uncrouch resizes the capsule anyway
+	HeadroomCache.bValid = bBlockingHit && Hit.GetComponent();
+	if (HeadroomCache.bValid)
+	{
+		HeadroomCache.Location = PawnLocation;
+		HeadroomCache.HalfHeight = PawnHalfHeight;
+		HeadroomCache.MaxRise = MaxRise;
+		HeadroomCache.Headroom = Headroom;
+		HeadroomCache.Blocker = Hit.GetComponent();
+		HeadroomCache.BlockerTransform = Hit.GetComponent()->GetComponentTransform();
+	}
+	return Headroom;
+}
+
+void UPBPlayerMovement::GatherLocalGeometry(float DeltaTime)
+{
+	float PawnRadius, PawnHalfHeight;
+	CharacterOwner->GetCapsuleComponent()->GetScaledCapsuleSize(PawnRadius, PawnHalfHeight);
+
+	// Area we can reach this tick, with room for the hemisphere probe
+	const FVector Start = UpdatedComponent->GetComponentLocation();
+	const FVector End = Start + Velocity * DeltaTime;
+	const FVector Reach(PawnRadius + SWEEP_EDGE_REJECT_DISTANCE + MAX_FLOOR_DIST, PawnRadius + SWEEP_EDGE_REJECT_DISTANCE + MAX_FLOOR_DIST, PawnHalfHeight + MAX_FLOOR_DIST);
+	const FBox Bounds = FBox(Start.ComponentMin(End) - Reach, Start.ComponentMax(End) + Reach);
+
+	// Already gathered this tick (PhysFalling restarted), and still covering where we go
+	if (LocalGeometry.bValid && LocalGeometry.FrameNumber == GFrameCounter && LocalGeometry.Bounds.IsInsideOrOn(Bounds.Min) && LocalGeometry.Bounds.IsInsideOrOn(Bounds.Max))
+	{
+		return;
+	}
+
+	LocalGeometry.bValid = false;
+	LocalGeometry.Components.Reset();
+
+	// Don't snapshot huge areas (teleports, very high speeds), the probe will trace the world instead
+	if (Bounds.GetExtent().GetMax() > MaxLocalGeometryExtent)
+	{
+		return;
+	}
+
+	FCollisionQueryParams QueryParams(SCENE_QUERY_STAT(CapsuleHemisphereGeometry), false, CharacterOwner);
+	FCollisionResponseParams ResponseParam;
+	InitCollisionParams(QueryParams, ResponseParam);
+	const ECollisionChannel CollisionChannel = UpdatedComponent->GetCollisionObjectType();
+	LocalGeometryOverlaps.Reset();
+	CountSceneQuery(EPBSceneQueryKind::Overlap, EPBSceneQuerySite::LocalGeometry);
+	GetWorld()->OverlapMultiByChannel(LocalGeometryOverlaps, Bounds.GetCenter(), FQuat::Identity, CollisionChannel, FCollisionShape::MakeBox(Bounds.GetExtent()), QueryParams, ResponseParam);
+	for (const FOverlapResult& Overlap : LocalGeometryOverlaps)
+	{
+		UPrimitiveComponent* Component = Overlap.GetComponent();
+		if (Overlap.bBlockingHit && Component)
+		{
+			LocalGeometry.Components.AddUnique(Component);
+		}
+	}
+
+	LocalGeometry.FrameNumber = GFrameCounter;
+	LocalGeometry.Bounds = Bounds;
+	LocalGeometry.bValid = true;
+}
+
+bool UPBPlayerMovement::IsCoveredByLocalGeometry(const FVector& Start, const FVector& End) const
+{
+	return LocalGeometry.bValid && LocalGeometry.FrameNumber == GFrameCounter && LocalGeometry.Bounds.IsInsideOrOn(Start) && LocalGeometry.Bounds.IsInsideOrOn(End);
+}
+
+bool UPBPlayerMovement::LineTraceLocalGeometry(FHitResult& OutHit, const FVector& Start, const FVector& End, const FCollisionQueryParams& Params) const
+{
+	bool bBlockingHit = false;
+	for (const TWeakObjectPtr<UPrimitiveComponent>& WeakComponent : LocalGeometry.Components)
+	{
+		UPrimitiveComponent* Component = WeakComponent.Get();
+		FHitResult ComponentHit(1.f);
+		if (Component && Component->LineTraceComponent(ComponentHit, Start, End, Params) && (!bBlockingHit || ComponentHit.Time < OutHit.Time))
+		{
+			OutHit = ComponentHit;
+			OutHit.bBlockingHit = true;
+			bBlockingHit = true;
+		}
+	}
+	return bBlockingHit;
+}
+
 bool UPBPlayerMovement::MoveUpdatedComponentImpl(const FVector& Delta, const FQuat& NewRotation, bool bSweep, FHitResult* OutHit, ETeleportType Teleport)
 {
 	FVector NewDelta = Delta;
@@ -2139,25 +2895,47 @@ bool UPBPlayerMovement::MoveUpdatedComponentImpl(const FVector& Delta, const FQu
 			LineTraceStart.Z += -PawnHalfHeight + MAX_FLOOR_DIST + Delta.Z;
 			// Inflate our search radius so we can anticipate new surfaces
 			FVector DeltaDir = Delta.GetSafeNormal2D() * (PawnRadius + SWEEP_EDGE_REJECT_DISTANCE);
-			FCollisionQueryParams QueryParams(SCENE_QUERY_STAT(CapsuleHemisphereTrace), false, CharacterOwner);
-			FCollisionResponseParams ResponseParam;
-			InitCollisionParams(QueryParams, ResponseParam);
-			const ECollisionChannel CollisionChannel = UpdatedComponent->GetCollisionObjectType();
-			FHitResult Hit(1.f);
-			const bool bBlockingHit = GetWorld()->LineTraceSingleByChannel(Hit, LineTraceStart, LineTraceStart + DeltaDir, CollisionChannel, QueryParams, ResponseParam);
-			if (bBlockingHit && FMath::Abs(Hit.ImpactNormal.Z) <= VERTICAL_SLOPE_NORMAL_Z)
+			const FVector LineTraceEnd = LineTraceStart + DeltaDir;
+			const bool bUseLocalGeometry = IsCoveredByLocalGeometry(LineTraceStart, LineTraceEnd);
+			// Nothing to hit around us (open air), skip the probe entirely
+			if (!bUseLocalGeometry || LocalGeometry.Components.Num() > 0)
 			{
-				// DrawDebugLine(GetWorld(), LineTraceStart, LineTraceStart + DeltaDir, FColor::Red, false, 10.0f, 0, 0.5f);
-				// UE_LOG(LogTemp, Log, TEXT("%f"), Hit.ImpactNormal.Z);
-				//  Blocked horizontally by box
-				NewDelta = Super::ComputeSlideVector(Delta, 1.0f, Hit.ImpactNormal, Hit);
+				FCollisionQueryParams QueryParams(SCENE_QUERY_STAT(CapsuleHemisphereTrace), false, CharacterOwner);
+				FCollisionResponseParams ResponseParam;
+				InitCollisionParams(QueryParams, ResponseParam);
+				const ECollisionChannel CollisionChannel = UpdatedComponent->GetCollisionObjectType();
+				FHitResult Hit(1.f);
+				if (!bUseLocalGeometry)
+				{
+					CountSceneQuery(EPBSceneQueryKind::LineTrace, EPBSceneQuerySite::FallingProbe);
+				}
+				const bool bBlockingHit = bUseLocalGeometry
+					? LineTraceLocalGeometry(Hit, LineTraceStart, LineTraceEnd, QueryParams)
+					: GetWorld()->LineTraceSingleByChannel(Hit, LineTraceStart, LineTraceEnd, CollisionChannel, QueryParams, ResponseParam);
+				if (bBlockingHit && FMath::Abs(Hit.ImpactNormal.Z) <= VERTICAL_SLOPE_NORMAL_Z)
+				{
+					// DrawDebugLine(GetWorld(), LineTraceStart, LineTraceStart + DeltaDir, FColor::Red, false, 10.0f, 0, 0.5f);
+					// UE_LOG(LogTemp, Log, TEXT("%f"), Hit.ImpactNormal.Z);
+					//  Blocked horizontally by box
+					NewDelta = Super::ComputeSlideVector(Delta, 1.0f, Hit.ImpactNormal, Hit);
+				}
 			}
 		}
 	}
 
+	if (bSweep && !NewDelta.IsZero())
+	{
+		CountSceneQuery(EPBSceneQueryKind::Sweep, bIsSteppingUp ? EPBSceneQuerySite::StepUp : EPBSceneQuerySite::Move);
+	}
 	return Super::MoveUpdatedComponentImpl(NewDelta, NewRotation, bSweep, OutHit, Teleport);
 }
 
+bool UPBPlayerMovement::StepUp(const FVector& GravDir, const FVector& Delta, const FHitResult& Hit, FStepDownResult* OutStepDownResult)
+{
+	TGuardValue<bool> RestoreSteppingUp(bIsSteppingUp, true);
+	return Super::StepUp(GravDir, Delta, Hit, OutStepDownResult);
+}
+
 bool UPBPlayerMovement::CanAttemptJump() const
 {
 	bool bCanAttemptJump = IsJumpAllowed();
@@ -2230,6 +3008,286 @@ float UPBPlayerMovement::GetMaxBrakingDeceleration() const
 	}
 }
 
+FNetworkPredictionData_Client* UPBPlayerMovement::GetPredictionData_Client() const
+{
+	if (ClientPredictionData == nullptr)
+	{
+		UPBPlayerMovement* MutableThis = const_cast<UPBPlayerMovement*>(this);
+		MutableThis->ClientPredictionData = new FNetworkPredictionData_Client_PB(*this);
+	}
+	return ClientPredictionData;
+}
+
+void UPBPlayerMovement::UpdateFromCompressedFlags(uint8 Flags)
+{
+	Super::UpdateFromCompressedFlags(Flags);
+
+	if (!PBCharacter)
+	{
+		return;
+	}
+	// The server simulates the speed the client asked for
+	PBCharacter->SetSprinting((Flags & FSavedMove_PB::FLAG_WantsToSprint) != 0);
+	PBCharacter->SetWantsToWalk((Flags & FSavedMove_PB::FLAG_WantsToWalk) != 0);
+}
+
+bool UPBPlayerMovement::ClientUpdatePositionAfterServerUpdate()
+{
+	if (!PBCharacter)
+	{
+		return Super::ClientUpdatePositionAfterServerUpdate();
+	}
+
+	// Replayed moves bring back the inputs they were made with, put back the live ones afterwards
+	const bool bRealSprinting = PBCharacter->IsSprinting();
+	const bool bRealWantsToWalk = PBCharacter->DoesWantToWalk();
+
+	// The PB state starts over from where the first replayed move started, on top of the server's correction.
+	// The replay then carries it forward, and we keep whatever it ends up with.
+	FNetworkPredictionData_Client_Character* ClientData = GetPredictionData_Client_Character();
+	if (ClientData && ClientData->bUpdatePosition && ClientData->SavedMoves.Num() > 0)
+	{
+		const TOptional<FLadderData> LiveLadderData = LadderData;
+		RestoreMoveState(static_cast<const FSavedMove_PB*>(ClientData->SavedMoves[0].Get())->StartState);
+		// The server may have taken us off the ladder
+		if (!IsOnLadder())
+		{
+			LadderData.Reset();
+			LadderDismounts.Reset();
+			bHasLadderDismounts = false;
+		}
+		// Or put us on a ladder we didn't grab. Without ladder data PhysLadder would drop us and the server would correct us again.
+		else if (!LadderData.IsSet())
+		{
+			FLadderData OverlappedLadder;
+			if (LiveLadderData.IsSet())
+			{
+				LadderData = LiveLadderData;
+			}
+			else if (FindOverlappedLadder(OverlappedLadder))
+			{
+				LadderData = OverlappedLadder;
+			}
+
+			if (LadderData.IsSet())
+			{
+				ComputeLadderDismounts(LadderData.GetValue());
+			}
+		}
+	}
+
+	const bool bResult = Super::ClientUpdatePositionAfterServerUpdate();
+
+	PBCharacter->SetSprinting(bRealSprinting);
+	PBCharacter->SetWantsToWalk(bRealWantsToWalk);
+	return bResult;
+}
+
+void UPBPlayerMovement::ServerMove_PerformMovement(const FCharacterNetworkMoveData& MoveData)
+{
+	Super::ServerMove_PerformMovement(MoveData);
+
+	// Only check moves we simulated, old or invalid ones are skipped by the engine
+	FNetworkPredictionData_Server_Character* ServerData = GetPredictionData_Server_Character();
+	if (!ServerData || ServerData->CurrentClientTimeStamp != MoveData.TimeStamp)
+	{
+		return;
+	}
+
+	// Record the corrections sent for this move. Counted here rather than in ServerCheckClientError,
+	// the engine doesn't call it for forced corrections, like the ones for getting on or off a ladder.
+	const bool bCorrectingMove = !ServerData->PendingAdjustment.bAckGoodMove && ServerData->PendingAdjustment.TimeStamp == MoveData.TimeStamp;
+	if (bCorrectingMove)
+	{
+		FVector ClientLoc = MoveData.Location;
+		if (MovementBaseUtility::UseRelativeLocation(MoveData.MovementBase))
+		{
+			MovementBaseUtility::TransformLocationToWorld(MoveData.MovementBase, MoveData.MovementBaseBoneName, MoveData.Location, ClientLoc);
+		}
+		else
+		{
+			ClientLoc = FRepMovement::RebaseOntoLocalOrigin(ClientLoc, this);
+		}
+		CountCorrection(MakeCorrectionRecord(MoveData.TimeStamp, ClientLoc, MoveData.MovementMode));
+	}
+
+	// The position check still runs either way, the hash only tells whether the client agrees on the PB state
+	const uint8 ClientHash = static_cast<const FPBNetworkMoveData&>(MoveData).MoveStateHash;
+	const uint8 ServerHash = GetMoveStateHash();
+	if (ClientHash == ServerHash)
+	{
+		return;
+	}
+	INC_DWORD_STAT(STAT_PBStateHashMismatches);
+	CSV_CUSTOM_STAT(PBMovement, StateHashMismatches, 1, ECsvCustomStatOp::Accumulate);
+
+	// A position correction already carries the movement mode, and replays restart from it
+	if (bCorrectingMove)
+	{
+		return;
+	}
+
+	// Getting on or off a ladder changes the movement mode, that needs a full correction
+	if ((ClientHash ^ ServerHash) & 1)
+	{
+		ServerData->bForceClientUpdate = true;
+		return;
+	}
+
+	const float WorldTime = GetWorld()->GetTimeSeconds();
+	if (LastPBStateAdjustmentTime >= 0.0f && WorldTime - LastPBStateAdjustmentTime < NetworkMinTimeBetweenClientAdjustments)
+	{
+		return;
+	}
+	LastPBStateAdjustmentTime = WorldTime;
+
+	FPBNetMoveState State;
+	State.CrouchAlpha = (uint8)FMath::RoundToInt(FMath::Clamp(GetCrouchAlpha(), 0.0f, 1.0f) * 255.0f);
+	State.bIsInCrouchTransition = bIsInCrouchTransition;
+	State.bIsPowerSliding = bIsPowerSliding;
+	ClientAdjustPBState(MoveData.TimeStamp, State);
+}
+
+void UPBPlayerMovement::ClientAdjustPBState_Implementation(float TimeStamp, FPBNetMoveState State)
+{
+	if (!HasValidData() || !IsActive())
+	{
+		return;
+	}
+
+	FNetworkPredictionData_Client_Character* ClientData = GetPredictionData_Client_Character();
+	if (!ClientData)
+	{
+		return;
+	}
+
+	// The server's state is the one the acked move ended with, we may already be a few moves ahead.
+	// Without that move we can't tell which of our moves it applies to.
+	const int32 AckedMoveIndex = ClientData->GetSavedMoveIndex(TimeStamp);
+	if (AckedMoveIndex == INDEX_NONE)
+	{
+		return;
+	}
+
+	// The capsule follows on the next crouch update
+	const auto ApplyServerState = [&State](FPBMoveState& MoveState)
+	{
+		const float ServerCrouchAlpha = State.CrouchAlpha / 255.0f;
+		MoveState.bIsPowerSliding = State.bIsPowerSliding;
+		MoveState.bIsInCrouchTransition = State.bIsInCrouchTransition || !FMath::IsNearlyEqual(MoveState.CrouchAlpha, ServerCrouchAlpha, 0.5f / 255.0f);
+		MoveState.CrouchAlpha = ServerCrouchAlpha;
+	};
+
+	if (AckedMoveIndex == ClientData->SavedMoves.Num() - 1)
+	{
+		// No newer moves, our state is the one the acked move ended with
+		FPBMoveState LiveState;
+		SaveMoveState(LiveState);
+		ApplyServerState(LiveState);
+		RestoreMoveState(LiveState);
+		return;
+	}
+
+	// Newer moves start from the server's state, and are replayed from where we ended the acked move
+	const FSavedMove_Character* AckedMove = ClientData->SavedMoves[AckedMoveIndex].Get();
+	ApplyServerState(static_cast<FSavedMove_PB*>(ClientData->SavedMoves[AckedMoveIndex + 1].Get())->StartState);
+	UPrimitiveComponent* AckedMoveBase = AckedMove->EndBase.Get();
+	ClientAdjustPosition_Implementation(TimeStamp, AckedMove->SavedLocation, AckedMove->SavedVelocity, AckedMoveBase, AckedMove->EndBoneName, AckedMoveBase != nullptr, false, AckedMove->EndPackedMovementMode);
+}
+
+uint8 UPBPlayerMovement::GetMoveStateHash() const
+{
+	// Small enough to pack rather than hash: ladder, slide and crouch flags.
+	// The crouch progress is left out, float noise near a rounding edge would send adjustments for the same state.
+	uint8 Hash = 0;
+	Hash |= IsOnLadder() ? 1 << 0 : 0;
+	Hash |= bIsPowerSliding ? 1 << 1 : 0;
+	Hash |= bIsInCrouchTransition ? 1 << 2 : 0;
+	Hash |= IsCrouching() ? 1 << 3 : 0;
+	return Hash;
+}
+
+void UPBPlayerMovement::SaveMoveState(FPBMoveState& OutState) const
+{
+	OutState.bHasLadderData = LadderData.IsSet();
+	if (LadderData.IsSet())
+	{
+		OutState.LadderData = LadderData.GetValue();
+	}
+	OutState.bHasRegrabbableLadderData = RegrabbableLadderData.IsSet();
+	if (RegrabbableLadderData.IsSet())
+	{
+		OutState.RegrabbableLadderData = RegrabbableLadderData.GetValue();
+	}
+	OutState.bHasLookingUpLadder = bIsLookingUpLadder.IsSet();
+	OutState.bIsLookingUpLadder = bIsLookingUpLadder.Get(false);
+	OutState.bAllowRegrabLadder = bAllowRegrabLadder;
+	OutState.bHasCachedImmersionDepth = CachedImmersionDepth.IsSet();
+	OutState.CachedImmersionDepth = CachedImmersionDepth.Get(0.0f);
+	OutState.bIsPowerSliding = bIsPowerSliding;
+	OutState.bCrouchFrameTolerated = bCrouchFrameTolerated;
+	OutState.bIsInCrouchTransition = bIsInCrouchTransition;
+	OutState.SimulationTime = SimulationTime;
+	OutState.PowerSlideEndTime = PowerSlideEndTime;
+	OutState.LadderRegrabStartTime = LadderRegrabStartTime;
+	OutState.CoyoteStartTime = CoyoteStartTime;
+	OutState.GroundedStartTime = GroundedStartTime;
+	OutState.SurfaceFriction = SurfaceFriction;
+	OutState.CrouchAlpha = CrouchAlpha;
+	OutState.bHasLadderDismounts = bHasLadderDismounts;
+	OutState.LadderDismountOrigin = LadderDismountOrigin;
+	OutState.NumLadderDismounts = FMath::Min(LadderDismounts.Num(), FPBMoveState::MaxLadderDismounts);
+	for (int32 Index = 0; Index < OutState.NumLadderDismounts; ++Index)
+	{
+		OutState.LadderDismountMinCoords[Index] = LadderDismounts[Index].MinCoord;
+		OutState.LadderDismountMaxCoords[Index] = LadderDismounts[Index].MaxCoord;
+	}
+}
+
+void UPBPlayerMovement::RestoreMoveState(const FPBMoveState& State)
+{
+	LadderData.Reset();
+	if (State.bHasLadderData)
+	{
+		LadderData = State.LadderData;
+	}
+	RegrabbableLadderData.Reset();
+	if (State.bHasRegrabbableLadderData)
+	{
+		RegrabbableLadderData = State.RegrabbableLadderData;
+	}
+	bIsLookingUpLadder.Reset();
+	if (State.bHasLookingUpLadder)
+	{
+		bIsLookingUpLadder = (bool)State.bIsLookingUpLadder;
+	}
+	bAllowRegrabLadder = State.bAllowRegrabLadder;
+	CachedImmersionDepth.Reset();
+	if (State.bHasCachedImmersionDepth)
+	{
+		CachedImmersionDepth = State.CachedImmersionDepth;
+	}
+	bIsPowerSliding = State.bIsPowerSliding;
+	bCrouchFrameTolerated = State.bCrouchFrameTolerated;
+	bIsInCrouchTransition = State.bIsInCrouchTransition;
+	SimulationTime = State.SimulationTime;
+	PowerSlideEndTime = State.PowerSlideEndTime;
+	LadderRegrabStartTime = State.LadderRegrabStartTime;
+	CoyoteStartTime = State.CoyoteStartTime;
+	GroundedStartTime = State.GroundedStartTime;
+	SurfaceFriction = State.SurfaceFriction;
+	CrouchAlpha = State.CrouchAlpha;
+	bHasLadderDismounts = State.bHasLadderDismounts;
+	LadderDismountOrigin = State.LadderDismountOrigin;
+	LadderDismounts.Reset();
+	for (int32 Index = 0; Index < State.NumLadderDismounts; ++Index)
+	{
+		FPBLadderDismount& Dismount = LadderDismounts.AddDefaulted_GetRef();
+		Dismount.MinCoord = State.LadderDismountMinCoords[Index];
+		Dismount.MaxCoord = State.LadderDismountMaxCoords[Index];
+	}
+}
+
 void UPBPlayerMovement::DisplayDebug(UCanvas* Canvas, const FDebugDisplayInfo& DebugDisplay, float& YL, float& YPos)
 {
 	if (CharacterOwner == NULL) {
@@ -2255,7 +3313,7 @@ void UPBPlayerMovement::DisplayDebug(UCanvas* Canvas, const FDebugDisplayInfo& D
 	T = FString::Printf(TEXT("bForceMaxAccel: %i"), bForceMaxAccel);
 	DisplayDebugManager.DrawString(T);
 
-	T = isinf(CoyoteTimeElapsed) ? L"+INF" : FString::Printf(L"%.1f ms", CoyoteTimeElapsed);
+	T = isinf(CoyoteStartTime) ? L"+INF" : FString::Printf(L"%.1f ms", GetSimulationTimeSince(CoyoteStartTime));
 	T = FString::Printf(TEXT("Coyote Time: %s (%s)"), IsInCoyoteTime() ? L"Yes" : L"No", * T);
 	DisplayDebugManager.DrawString(T);
 
@@ -2413,6 +3471,7 @@ bool UPBPlayerMovement::GrabLadder(const FLadderData& Ladder)
 	bAllowRegrabLadder = true;
 	RegrabbableLadderData.Reset();
 	LadderData = Ladder;
+	ComputeLadderDismounts(Ladder);
 	SetMovementMode(MOVE_Custom, MOVECUSTOM_Ladder);
 	// We grabbed a ladder
 	return true;
@@ -2436,4 +3495,444 @@ FVector UPBPlayerMovement::GetLadderJumpVelocity() const
 		return (LadderData->Normal * LadderJumpNormalVelocity)
 			 + (LadderData->Up * LadderJumpUpwardsVelocity);
 	}
-}
\ No newline at end of file
+}
+
+void FSavedMove_PB::Clear()
+{
+	Super::Clear();
+
+	bWantsToSprint = false;
+	bWantsToWalk = false;
+	StartState = FPBMoveState();
+	EndStateHash = 0;
+}
+
+uint8 FSavedMove_PB::GetCompressedFlags() const
+{
+	uint8 Result = Super::GetCompressedFlags();
+	if (bWantsToSprint)
+	{
+		Result |= FLAG_WantsToSprint;
+	}
+	if (bWantsToWalk)
+	{
+		Result |= FLAG_WantsToWalk;
+	}
+	return Result;
+}
+
+bool FSavedMove_PB::CanCombineWith(const FSavedMovePtr& NewMove, ACharacter* InCharacter, float MaxDelta) const
+{
+	// The sprint and walk inputs are compared by the parent through the compressed flags
+	const FPBMoveState& NewState = static_cast<const FSavedMove_PB*>(NewMove.Get())->StartState;
+
+	// Only combine moves where the same branches are picked and no timer restarted in between.
+	// Combining rewinds the crouch progress but not the capsule, so never combine crouch transitions.
+	if (StartState.bIsInCrouchTransition || NewState.bIsInCrouchTransition
+		|| StartState.bCrouchFrameTolerated != NewState.bCrouchFrameTolerated
+		|| StartState.bIsPowerSliding != NewState.bIsPowerSliding
+		|| StartState.bHasLadderData != NewState.bHasLadderData
+		|| StartState.bHasRegrabbableLadderData != NewState.bHasRegrabbableLadderData
+		|| StartState.PowerSlideEndTime != NewState.PowerSlideEndTime
+		|| StartState.LadderRegrabStartTime != NewState.LadderRegrabStartTime
+		|| StartState.CoyoteStartTime != NewState.CoyoteStartTime
+		|| StartState.GroundedStartTime != NewState.GroundedStartTime)
+	{
+		return false;
+	}
+
+	return Super::CanCombineWith(NewMove, InCharacter, MaxDelta);
+}
+
+void FSavedMove_PB::CombineWith(const FSavedMove_Character* OldMove, ACharacter* InCharacter, APlayerController* PC, const FVector& OldStartLocation)
+{
+	Super::CombineWith(OldMove, InCharacter, PC, OldStartLocation);
+
+	// The parent put the character back where the pending move started, do the same with the PB state
+	// so the combined move doesn't apply the pending move twice. This rewinds the simulation clock too,
+	// it then advances by both moves at once like on the server.
+	StartState = static_cast<const FSavedMove_PB*>(OldMove)->StartState;
+	if (UPBPlayerMovement* Movement = Cast<UPBPlayerMovement>(InCharacter->GetCharacterMovement()))
+	{
+		Movement->RestoreMoveState(StartState);
+	}
+}
+
+void FSavedMove_PB::SetMoveFor(ACharacter* C, float InDeltaTime, FVector const& NewAccel, FNetworkPredictionData_Client_Character& ClientData)
+{
+	Super::SetMoveFor(C, InDeltaTime, NewAccel, ClientData);
+
+	const APBPlayerCharacter* PBCharacter = Cast<APBPlayerCharacter>(C);
+	const UPBPlayerMovement* Movement = PBCharacter ? Cast<UPBPlayerMovement>(PBCharacter->GetCharacterMovement()) : nullptr;
+	if (!Movement)
+	{
+		return;
+	}
+
+	bWantsToSprint = PBCharacter->IsSprinting();
+	bWantsToWalk = PBCharacter->DoesWantToWalk();
+	Movement->SaveMoveState(StartState);
+}
+
+void FSavedMove_PB::PrepMoveFor(ACharacter* C)
+{
+	Super::PrepMoveFor(C);
+
+	// The sprint and walk inputs are restored from the compressed flags. The PB state carries over from the
+	// previous replayed move, it is what this move starts with now.
+	if (const UPBPlayerMovement* Movement = Cast<UPBPlayerMovement>(C->GetCharacterMovement()))
+	{
+		Movement->SaveMoveState(StartState);
+	}
+}
+
+void FSavedMove_PB::PostUpdate(ACharacter* C, EPostUpdateMode PostUpdateMode)
+{
+	Super::PostUpdate(C, PostUpdateMode);
+
+	// Replays can change the state moves end with, moves not sent yet need the new hash
+	if (PostUpdateMode == PostUpdate_Record || PostUpdateMode == PostUpdate_Replay)
+	{
+		if (const UPBPlayerMovement* Movement = Cast<UPBPlayerMovement>(C->GetCharacterMovement()))
+		{
+			EndStateHash = Movement->GetMoveStateHash();
+		}
+	}
+}
+
+void FPBNetworkMoveData::ClientFillNetworkMoveData(const FSavedMove_Character& ClientMove, ENetworkMoveType MoveType)
+{
+	Super::ClientFillNetworkMoveData(ClientMove, MoveType);
+
+	MoveStateHash = static_cast<const FSavedMove_PB&>(ClientMove).EndStateHash;
+}
+
+bool FPBNetworkMoveData::Serialize(UCharacterMovementComponent& CharacterMovement, FArchive& Ar, UPackageMap* PackageMap, ENetworkMoveType MoveType)
+{
+	Super::Serialize(CharacterMovement, Ar, PackageMap, MoveType);
+
+	Ar << MoveStateHash;
+	return !Ar.IsError();
+}
+
+FNetworkPredictionData_Client_PB::FNetworkPredictionData_Client_PB(const UCharacterMovementComponent& ClientMovement)
+	: Super(ClientMovement)
+{
+}
+
+FSavedMovePtr FNetworkPredictionData_Client_PB::AllocateNewMove()
+{
+	return FSavedMovePtr(new FSavedMove_PB());
+}
+
+uint64 FPBSceneQueryCounters::GetSiteTotal(EPBSceneQuerySite Site) const
+{
+	uint64 SiteTotal = 0;
+	for (int32 Kind = 0; Kind < (int32)EPBSceneQueryKind::Num; ++Kind)
+	{
+		SiteTotal += Counts[(int32)Site][Kind];
+	}
+	return SiteTotal;
+}
+
+uint64 FPBSceneQueryCounters::GetKindTotal(EPBSceneQueryKind Kind) const
+{
+	uint64 KindTotal = 0;
+	for (int32 Site = 0; Site < (int32)EPBSceneQuerySite::Num; ++Site)
+	{
+		KindTotal += Counts[Site][(int32)Kind];
+	}
+	return KindTotal;
+}
+
+float FPBSceneQueryCounters::GetQueriesPerFrame() const
+{
+	if (Total == 0)
+	{
+		return 0.0f;
+	}
+	return (float)Total / (float)(GFrameCounter - FirstFrame + 1);
+}
+
+void UPBPlayerMovement::CountSceneQuery(EPBSceneQueryKind Kind, EPBSceneQuerySite Site) const
+{
+#if !UE_BUILD_SHIPPING
+	if (SceneQueryCounters.Total == 0)
+	{
+		SceneQueryCounters.FirstFrame = GFrameCounter;
+	}
+	SceneQueryCounters.Counts[(int32)Site][(int32)Kind]++;
+	SceneQueryCounters.Total++;
+#endif
+
+	switch (Kind)
+	{
+	case EPBSceneQueryKind::Sweep:
+		INC_DWORD_STAT(STAT_PBSceneQuerySweep);
+		CSV_CUSTOM_STAT(PBMovement, Sweeps, 1, ECsvCustomStatOp::Accumulate);
+		break;
+	case EPBSceneQueryKind::LineTrace:
+		INC_DWORD_STAT(STAT_PBSceneQueryLineTrace);
+		CSV_CUSTOM_STAT(PBMovement, LineTraces, 1, ECsvCustomStatOp::Accumulate);
+		break;
+	case EPBSceneQueryKind::Overlap:
+		INC_DWORD_STAT(STAT_PBSceneQueryOverlap);
+		CSV_CUSTOM_STAT(PBMovement, Overlaps, 1, ECsvCustomStatOp::Accumulate);
+		break;
+	default:
+		break;
+	}
+
+	switch (Site)
+	{
+	case EPBSceneQuerySite::Move:
+		INC_DWORD_STAT(STAT_PBSceneQueryMove);
+		CSV_CUSTOM_STAT(PBMovement, MoveQueries, 1, ECsvCustomStatOp::Accumulate);
+		break;
+	case EPBSceneQuerySite::FindFloor:
+		INC_DWORD_STAT(STAT_PBSceneQueryFindFloor);
+		CSV_CUSTOM_STAT(PBMovement, FindFloorQueries, 1, ECsvCustomStatOp::Accumulate);
+		break;
+	case EPBSceneQuerySite::StepUp:
+		INC_DWORD_STAT(STAT_PBSceneQueryStepUp);
+		CSV_CUSTOM_STAT(PBMovement, StepUpQueries, 1, ECsvCustomStatOp::Accumulate);
+		break;
+	case EPBSceneQuerySite::FloorSample:
+		INC_DWORD_STAT(STAT_PBSceneQueryFloorSample);
+		CSV_CUSTOM_STAT(PBMovement, FloorSampleQueries, 1, ECsvCustomStatOp::Accumulate);
+		break;
+	case EPBSceneQuerySite::FallingProbe:
+		INC_DWORD_STAT(STAT_PBSceneQueryFallingProbe);
+		CSV_CUSTOM_STAT(PBMovement, FallingProbeQueries, 1, ECsvCustomStatOp::Accumulate);
+		break;
+	case EPBSceneQuerySite::LocalGeometry:
+		INC_DWORD_STAT(STAT_PBSceneQueryLocalGeometry);
+		CSV_CUSTOM_STAT(PBMovement, LocalGeometryQueries, 1, ECsvCustomStatOp::Accumulate);
+		break;
+	case EPBSceneQuerySite::Uncrouch:
+		INC_DWORD_STAT(STAT_PBSceneQueryUncrouch);
+		CSV_CUSTOM_STAT(PBMovement, UncrouchQueries, 1, ECsvCustomStatOp::Accumulate);
+		break;
+	case EPBSceneQuerySite::Ladder:
+		INC_DWORD_STAT(STAT_PBSceneQueryLadder);
+		CSV_CUSTOM_STAT(PBMovement, LadderQueries, 1, ECsvCustomStatOp::Accumulate);
+		break;
+	default:
+		break;
+	}
+}
+
+FArchive& operator<<(FArchive& Ar, FPBCorrectionRecord& Record)
+{
+	Ar << Record.ServerTime << Record.ClientTimeStamp << Record.PositionError;
+	Ar << Record.MovementMode << Record.CustomMovementMode << Record.ClientMovementMode;
+	uint8 Source = (uint8)Record.Source;
+	uint16 Flags = (uint16)Record.Flags;
+	Ar << Source << Flags;
+	Record.Source = (EPBCorrectionSource)Source;
+	Record.Flags = (EPBCorrectionFlags)Flags;
+	return Ar;
+}
+
+FPBCorrectionRecord UPBPlayerMovement::MakeCorrectionRecord(float ClientTimeStamp, const FVector& ClientLoc, uint8 ClientMovementMode) const
+{
+	FPBCorrectionRecord Record;
+	Record.ServerTime = GetWorld()->GetTimeSeconds();
+	Record.ClientTimeStamp = ClientTimeStamp;
+	Record.PositionError = FVector::Dist(UpdatedComponent->GetComponentLocation(), ClientLoc);
+	Record.MovementMode = MovementMode;
+	Record.CustomMovementMode = CustomMovementMode;
+	Record.ClientMovementMode = ClientMovementMode;
+
+	if (IsOnLadder())
+	{
+		Record.Flags |= EPBCorrectionFlags::OnLadder;
+	}
+	if (bIsPowerSliding)
+	{
+		Record.Flags |= EPBCorrectionFlags::PowerSliding;
+	}
+	if (bIsInCrouchTransition)
+	{
+		Record.Flags |= EPBCorrectionFlags::CrouchTransition;
+	}
+	if (IsCrouching())
+	{
+		Record.Flags |= EPBCorrectionFlags::Crouched;
+	}
+	if (IsFalling() && IsInCoyoteTime())
+	{
+		Record.Flags |= EPBCorrectionFlags::CoyoteTime;
+	}
+	if (IsBrakingWindowTolerated())
+	{
+		Record.Flags |= EPBCorrectionFlags::BrakingWindowElapsed;
+	}
+	if (IsTouchingWater())
+	{
+		Record.Flags |= EPBCorrectionFlags::TouchingWater;
+	}
+	if (IsSwimming())
+	{
+		Record.Flags |= EPBCorrectionFlags::Swimming;
+	}
+	if (PBCharacter && PBCharacter->IsSprinting())
+	{
+		Record.Flags |= EPBCorrectionFlags::Sprinting;
+	}
+	if (PBCharacter && PBCharacter->DoesWantToWalk())
+	{
+		Record.Flags |= EPBCorrectionFlags::Walking;
+	}
+
+	TEnumAsByte<EMovementMode> ClientMode;
+	uint8 ClientCustomMode;
+	TEnumAsByte<EMovementMode> ClientGroundMode;
+	UnpackNetworkMovementMode(ClientMovementMode, ClientMode, ClientCustomMode, ClientGroundMode);
+
+	// Blame the subsystem either side is in, the ones changing the movement mode first
+	if (IsOnLadder() || (ClientMode == MOVE_Custom && ClientCustomMode == MOVECUSTOM_Ladder))
+	{
+		Record.Source = EPBCorrectionSource::Ladder;
+	}
+	else if (IsSwimming() || ClientMode == MOVE_Swimming || IsTouchingWater())
+	{
+		Record.Source = EPBCorrectionSource::Water;
+	}
+	else if (bIsPowerSliding)
+	{
+		Record.Source = EPBCorrectionSource::PowerSlide;
+	}
+	else if (bIsInCrouchTransition)
+	{
+		Record.Source = EPBCorrectionSource::CrouchTransition;
+	}
+	else if (IsFalling() && IsInCoyoteTime())
+	{
+		Record.Source = EPBCorrectionSource::CoyoteJump;
+	}
+	else
+	{
+		Record.Source = EPBCorrectionSource::Other;
+	}
+	return Record;
+}
+
+void UPBPlayerMovement::CountCorrection(const FPBCorrectionRecord& Record) const
+{
+	INC_DWORD_STAT(STAT_PBCorrections);
+	CSV_CUSTOM_STAT(PBMovement, Corrections, 1, ECsvCustomStatOp::Accumulate);
+
+	switch (Record.Source)
+	{
+	case EPBCorrectionSource::Ladder:
+		INC_DWORD_STAT(STAT_PBCorrectionsLadder);
+		CSV_CUSTOM_STAT(PBMovement, LadderCorrections, 1, ECsvCustomStatOp::Accumulate);
+		break;
+	case EPBCorrectionSource::PowerSlide:
+		INC_DWORD_STAT(STAT_PBCorrectionsPowerSlide);
+		CSV_CUSTOM_STAT(PBMovement, PowerSlideCorrections, 1, ECsvCustomStatOp::Accumulate);
+		break;
+	case EPBCorrectionSource::Water:
+		INC_DWORD_STAT(STAT_PBCorrectionsWater);
+		CSV_CUSTOM_STAT(PBMovement, WaterCorrections, 1, ECsvCustomStatOp::Accumulate);
+		break;
+	case EPBCorrectionSource::CrouchTransition:
+		INC_DWORD_STAT(STAT_PBCorrectionsCrouchTransition);
+		CSV_CUSTOM_STAT(PBMovement, CrouchTransitionCorrections, 1, ECsvCustomStatOp::Accumulate);
+		break;
+	case EPBCorrectionSource::CoyoteJump:
+		INC_DWORD_STAT(STAT_PBCorrectionsCoyoteJump);
+		CSV_CUSTOM_STAT(PBMovement, CoyoteJumpCorrections, 1, ECsvCustomStatOp::Accumulate);
+		break;
+	default:
+		INC_DWORD_STAT(STAT_PBCorrectionsOther);
+		CSV_CUSTOM_STAT(PBMovement, OtherCorrections, 1, ECsvCustomStatOp::Accumulate);
+		break;
+	}
+
+	if (UPBCorrectionLogSubsystem* CorrectionLog = GetWorld()->GetSubsystem<UPBCorrectionLogSubsystem>())
+	{
+		CorrectionLog->AddRecord(Record);
+	}
+}
+
+#if !UE_BUILD_SHIPPING
+static void DumpSceneQueries(const TArray<FString>& Args, UWorld* World)
+{
+	static const TCHAR* SiteNames[] = { TEXT("Move"), TEXT("FindFloor"), TEXT("StepUp"), TEXT("FloorSample"), TEXT("FallingProbe"), TEXT("LocalGeometry"), TEXT("Uncrouch"), TEXT("Ladder") };
+	static_assert(UE_ARRAY_COUNT(SiteNames) == (int32)EPBSceneQuerySite::Num, "Missing scene query site name");
+
+	if (!World)
+	{
+		return;
+	}
+	const int32 TopCount = Args.Num() > 0 ? FMath::Max(FCString::Atoi(*Args[0]), 1) : 10;
+
+	TArray<const UPBPlayerMovement*> Movements;
+	FPBSceneQueryCounters WorldCounters;
+	for (TObjectIterator<UPBPlayerMovement> It; It; ++It)
+	{
+		if (It->GetWorld() != World || It->HasAnyFlags(RF_ClassDefaultObject))
+		{
+			continue;
+		}
+		const FPBSceneQueryCounters& Counters = It->GetSceneQueryCounters();
+		for (int32 Site = 0; Site < (int32)EPBSceneQuerySite::Num; ++Site)
+		{
+			for (int32 Kind = 0; Kind < (int32)EPBSceneQueryKind::Num; ++Kind)
+			{
+				WorldCounters.Counts[Site][Kind] += Counters.Counts[Site][Kind];
+			}
+		}
+		WorldCounters.Total += Counters.Total;
+		Movements.Add(*It);
+	}
+
+	UE_LOG(LogPBMovement, Log, TEXT("Scene queries in %s: %llu total (%llu sweeps, %llu line traces, %llu overlaps) from %d characters"),
+		*World->GetName(), WorldCounters.Total,
+		WorldCounters.GetKindTotal(EPBSceneQueryKind::Sweep), WorldCounters.GetKindTotal(EPBSceneQueryKind::LineTrace), WorldCounters.GetKindTotal(EPBSceneQueryKind::Overlap),
+		Movements.Num());
+
+	Movements.Sort([](const UPBPlayerMovement& A, const UPBPlayerMovement& B)
+	{
+		return A.GetSceneQueryCounters().GetQueriesPerFrame() > B.GetSceneQueryCounters().GetQueriesPerFrame();
+	});
+
+	for (int32 Index = 0; Index < FMath::Min(TopCount, Movements.Num()); ++Index)
+	{
+		const FPBSceneQueryCounters& Counters = Movements[Index]->GetSceneQueryCounters();
+		FString Sites;
+		for (int32 Site = 0; Site < (int32)EPBSceneQuerySite::Num; ++Site)
+		{
+			Sites += FString::Printf(TEXT(" %s=%llu"), SiteNames[Site], Counters.GetSiteTotal((EPBSceneQuerySite)Site));
+		}
+		UE_LOG(LogPBMovement, Log, TEXT("  %s: %.2f per frame, %llu total (%llu sweeps, %llu line traces, %llu overlaps):%s"),
+			*GetNameSafe(Movements[Index]->GetOwner()), Counters.GetQueriesPerFrame(), Counters.Total,
+			Counters.GetKindTotal(EPBSceneQueryKind::Sweep), Counters.GetKindTotal(EPBSceneQueryKind::LineTrace), Counters.GetKindTotal(EPBSceneQueryKind::Overlap),
+			*Sites);
+	}
+}
+
+static void ResetSceneQueries(UWorld* World)
+{
+	for (TObjectIterator<UPBPlayerMovement> It; It; ++It)
+	{
+		if (It->GetWorld() == World)
+		{
+			It->ResetSceneQueryCounters();
+		}
+	}
+}
+
+static FAutoConsoleCommandWithWorldAndArgs CmdDumpSceneQueries(
+	TEXT("pb.DumpSceneQueries"),
+	TEXT("Log the scene queries issued by player movement in this world, and by the N characters issuing the most per frame.\n")
+	TEXT("Usage: pb.DumpSceneQueries [N=10]"),
+	FConsoleCommandWithWorldAndArgsDelegate::CreateStatic(&DumpSceneQueries));
+
+static FAutoConsoleCommandWithWorld CmdResetSceneQueries(
+	TEXT("pb.ResetSceneQueries"),
+	TEXT("Reset the scene query counters of player movement in this world."),
+	FConsoleCommandWithWorldDelegate::CreateStatic(&ResetSceneQueries));
+#endif
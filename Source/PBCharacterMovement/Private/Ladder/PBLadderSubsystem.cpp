@@ -0,0 +1,180 @@
+// Copyright Project Borealis
+
+#include "Ladder/PBLadderSubsystem.h"
+
+#include "Components/PrimitiveComponent.h"
+#include "Engine/World.h"
+#include "EngineUtils.h"
+
+namespace
+{
+	/** Squared distance from a point to a box centered on the origin, both in box space */
+	float BoxDistSquared(const FVector& Point, const FVector& Extent)
+	{
+		const FVector Outside(
+			FMath::Max(FMath::Abs(Point.X) - Extent.X, 0.0f),
+			FMath::Max(FMath::Abs(Point.Y) - Extent.Y, 0.0f),
+			FMath::Max(FMath::Abs(Point.Z) - Extent.Z, 0.0f));
+		return Outside.SizeSquared();
+	}
+}
+
+bool FPBLadderBounds::OverlapsCapsule(const FVector& CapsuleLocation, const FQuat& CapsuleRotation, float CapsuleRadius, float CapsuleHalfHeight) const
+{
+	// Early out if the bounding spheres don't touch
+	const float MaxReach = Extent.Size() + CapsuleHalfHeight;
+	if ((CapsuleLocation - Center).SizeSquared() > FMath::Square(MaxReach))
+	{
+		return false;
+	}
+
+	const auto ToBoxSpace = [this](const FVector& WorldLocation)
+	{
+		const FVector Offset = WorldLocation - Center;
+		return FVector(Offset | Normal, Offset | Right, Offset | Up);
+	};
+
+	// Capsule inner segment, in box space
+	const FVector SegmentAxis = CapsuleRotation.GetUpVector() * FMath::Max(CapsuleHalfHeight - CapsuleRadius, 0.0f);
+	const FVector Start = ToBoxSpace(CapsuleLocation - SegmentAxis);
+	const FVector End = ToBoxSpace(CapsuleLocation + SegmentAxis);
+
+	const float RadiusSquared = FMath::Square(CapsuleRadius);
+	if (BoxDistSquared(Start, Extent) <= RadiusSquared || BoxDistSquared(End, Extent) <= RadiusSquared)
+	{
+		return true;
+	}
+
+	// The distance from the box to a point moving along the segment is convex,
+	// so a ternary search finds the closest point of the segment.
+	float Low = 0.0f;
+	float High = 1.0f;
+	for (int32 Iteration = 0; Iteration < 16; ++Iteration)
+	{
+		const float Third = (High - Low) / 3.0f;
+		const float A = Low + Third;
+		const float B = High - Third;
+		if (BoxDistSquared(FMath::Lerp(Start, End, A), Extent) <= BoxDistSquared(FMath::Lerp(Start, End, B), Extent))
+		{
+			High = B;
+		}
+		else
+		{
+			Low = A;
+		}
+	}
+	return BoxDistSquared(FMath::Lerp(Start, End, 0.5f * (Low + High)), Extent) <= RadiusSquared;
+}
+
+void UPBLadderSubsystem::Deinitialize()
+{
+	Ladders.Empty();
+	RegisteredObjectTypes.Empty();
+	Super::Deinitialize();
+}
+
+void UPBLadderSubsystem::RegisterLaddersByObjectType(ECollisionChannel LadderObjectType)
+{
+	// Built-in object types are used by the whole world, don't register everything as a ladder
+	if (LadderObjectType < ECC_GameTraceChannel1 || RegisteredObjectTypes.Contains(LadderObjectType))
+	{
+		return;
+	}
+	RegisteredObjectTypes.Add(LadderObjectType);
+
+	for (TActorIterator<AActor> It(GetWorld()); It; ++It)
+	{
+		It->ForEachComponent<UPrimitiveComponent>(false, [this, LadderObjectType](UPrimitiveComponent* Component)
+		{
+			if (Component->GetCollisionObjectType() == LadderObjectType)
+			{
+				RegisterLadder(Component);
+			}
+		});
+	}
+}
+
+const FPBLadderBounds* UPBLadderSubsystem::RegisterLadder(UPrimitiveComponent* Component)
+{
+	if (!IsValid(Component))
+	{
+		return nullptr;
+	}
+
+	if (const FPBLadderBounds* Bounds = FindLadder(Component))
+	{
+		return Bounds;
+	}
+
+	FPBLadderBounds& Bounds = Ladders.Add(TObjectKey<UPrimitiveComponent>(Component));
+	ComputeBounds(Component, Bounds);
+	return &Bounds;
+}
+
+void UPBLadderSubsystem::UnregisterLadder(const UPrimitiveComponent* Component)
+{
+	Ladders.Remove(TObjectKey<UPrimitiveComponent>(Component));
+}
+
+const FPBLadderBounds* UPBLadderSubsystem::FindLadder(const UPrimitiveComponent* Component)
+{
+	FPBLadderBounds* Bounds = Ladders.Find(TObjectKey<UPrimitiveComponent>(Component));
+	if (!Bounds)
+	{
+		return nullptr;
+	}
+
+	UPrimitiveComponent* LadderComponent = Bounds->Component.Get();
+	if (!LadderComponent)
+	{
+		// Ladder was destroyed
+		Ladders.Remove(TObjectKey<UPrimitiveComponent>(Component));
+		return nullptr;
+	}
+
+	// Static ladders never move, others are refreshed when their transform changes
+	if (LadderComponent->Mobility == EComponentMobility::Movable && !LadderComponent->GetComponentTransform().Equals(Bounds->ComponentTransform))
+	{
+		ComputeBounds(LadderComponent, *Bounds);
+	}
+	return Bounds;
+}
+
+UPrimitiveComponent* UPBLadderSubsystem::FindOverlappingLadder(const FVector& CapsuleLocation, const FQuat& CapsuleRotation, float CapsuleRadius, float CapsuleHalfHeight)
+{
+	for (TPair<TObjectKey<UPrimitiveComponent>, FPBLadderBounds>& Ladder : Ladders)
+	{
+		FPBLadderBounds& Bounds = Ladder.Value;
+		UPrimitiveComponent* LadderComponent = Bounds.Component.Get();
+		if (!LadderComponent)
+		{
+			// Destroyed ladders are dropped by FindLadder, we can't remove them while iterating
+			continue;
+		}
+
+		if (LadderComponent->Mobility == EComponentMobility::Movable && !LadderComponent->GetComponentTransform().Equals(Bounds.ComponentTransform))
+		{
+			ComputeBounds(LadderComponent, Bounds);
+		}
+		if (Bounds.OverlapsCapsule(CapsuleLocation, CapsuleRotation, CapsuleRadius, CapsuleHalfHeight))
+		{
+			return LadderComponent;
+		}
+	}
+	return nullptr;
+}
+
+void UPBLadderSubsystem::ComputeBounds(UPrimitiveComponent* Component, FPBLadderBounds& OutBounds)
+{
+	const FTransform& Transform = Component->GetComponentTransform();
+	// Bounds in component space, so we keep the orientation of the ladder
+	const FBoxSphereBounds LocalBounds = Component->CalcBounds(FTransform::Identity);
+
+	OutBounds.Component = Component;
+	OutBounds.ComponentTransform = Transform;
+	OutBounds.Center = Transform.TransformPosition(LocalBounds.Origin);
+	OutBounds.Extent = LocalBounds.BoxExtent * Transform.GetScale3D().GetAbs();
+	OutBounds.Normal = Transform.GetUnitAxis(EAxis::X);
+	OutBounds.Right = Transform.GetUnitAxis(EAxis::Y);
+	OutBounds.Up = Transform.GetUnitAxis(EAxis::Z);
+}
@@ -0,0 +1,145 @@
+// Copyright Project Borealis
+
+#include "LagCompensation/PBLagCompensationSubsystem.h"
+
+#include "Engine/World.h"
+
+#include "Character/PBPlayerCharacter.h"
+#include "Character/PBPlayerMovement.h"
+
+DECLARE_CYCLE_STAT(TEXT("Rewind All Capsules"), STAT_PBRewindAll, STATGROUP_PBMovement);
+
+void FPBCapsuleHistory::Record(const FPBCapsuleSample& Sample)
+{
+	if (Num > 0)
+	{
+		FPBCapsuleSample& Newest = Samples[(Head + Num - 1) % Capacity];
+		if (Sample.Timestamp <= Newest.Timestamp)
+		{
+			Newest = Sample;
+			return;
+		}
+	}
+
+	if (Num < Capacity)
+	{
+		Samples[(Head + Num) % Capacity] = Sample;
+		++Num;
+	}
+	else
+	{
+		// Full, overwrite the oldest
+		Samples[Head] = Sample;
+		Head = (Head + 1) % Capacity;
+	}
+}
+
+bool FPBCapsuleHistory::Rewind(float Time, FPBCapsuleSample& OutSample) const
+{
+	if (Num == 0 || Time < (*this)[0].Timestamp)
+	{
+		return false;
+	}
+
+	const FPBCapsuleSample& Newest = (*this)[Num - 1];
+	if (Time >= Newest.Timestamp)
+	{
+		OutSample = Newest;
+		return true;
+	}
+
+	// Bracket the time, Low is at or before it and High after it
+	int32 Low = 0;
+	int32 High = Num - 1;
+	while (High - Low > 1)
+	{
+		const int32 Mid = (Low + High) / 2;
+		if ((*this)[Mid].Timestamp <= Time)
+		{
+			Low = Mid;
+		}
+		else
+		{
+			High = Mid;
+		}
+	}
+
+	const FPBCapsuleSample& Before = (*this)[Low];
+	const FPBCapsuleSample& After = (*this)[High];
+	const float Alpha = (Time - Before.Timestamp) / (After.Timestamp - Before.Timestamp);
+
+	OutSample.Timestamp = Time;
+	OutSample.Location = FMath::Lerp(Before.Location, After.Location, Alpha);
+	OutSample.Rotation = FQuat::Slerp(Before.Rotation, After.Rotation, Alpha);
+	OutSample.CapsuleHalfHeight = FMath::Lerp(Before.CapsuleHalfHeight, After.CapsuleHalfHeight, Alpha);
+	// Modes can't be blended, use the closest sample
+	const FPBCapsuleSample& Closest = Alpha < 0.5f ? Before : After;
+	OutSample.MovementMode = Closest.MovementMode;
+	OutSample.CustomMovementMode = Closest.CustomMovementMode;
+	return true;
+}
+
+void UPBLagCompensationSubsystem::Deinitialize()
+{
+	Characters.Empty();
+	Super::Deinitialize();
+}
+
+TStatId UPBLagCompensationSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UPBLagCompensationSubsystem, STATGROUP_Tickables);
+}
+
+void UPBLagCompensationSubsystem::RegisterCharacter(APBPlayerCharacter* Character)
+{
+	if (IsValid(Character) && Character->HasAuthority())
+	{
+		Characters.AddUnique(Character);
+	}
+}
+
+void UPBLagCompensationSubsystem::UnregisterCharacter(APBPlayerCharacter* Character)
+{
+	Characters.RemoveSwap(Character);
+}
+
+void UPBLagCompensationSubsystem::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	// Tickables run after the tick groups, so every character has moved by now
+	const float Time = GetWorld()->GetTimeSeconds();
+	for (int32 Index = Characters.Num() - 1; Index >= 0; --Index)
+	{
+		APBPlayerCharacter* Character = Characters[Index].Get();
+		if (!Character)
+		{
+			Characters.RemoveAtSwap(Index);
+			continue;
+		}
+		Character->RecordCapsule(Time);
+	}
+}
+
+int32 UPBLagCompensationSubsystem::RewindAll(float Time, TArray<FPBRewoundCapsule>& OutCapsules, const APBPlayerCharacter* IgnoredCharacter) const
+{
+	SCOPE_CYCLE_COUNTER(STAT_PBRewindAll);
+
+	OutCapsules.Reset(Characters.Num());
+	for (const TWeakObjectPtr<APBPlayerCharacter>& WeakCharacter : Characters)
+	{
+		APBPlayerCharacter* Character = WeakCharacter.Get();
+		if (!Character || Character == IgnoredCharacter)
+		{
+			continue;
+		}
+
+		FPBRewoundCapsule Rewound;
+		if (Character->GetCapsuleHistory().Rewind(Time, Rewound.Sample))
+		{
+			Rewound.Character = Character;
+			OutCapsules.Add(Rewound);
+		}
+	}
+	return OutCapsules.Num();
+}
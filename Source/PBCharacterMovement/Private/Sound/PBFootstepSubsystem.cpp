@@ -0,0 +1,120 @@
+// Copyright Project Borealis
+
+#include "Sound/PBFootstepSubsystem.h"
+
+#include "Engine/World.h"
+#include "GameFramework/PlayerController.h"
+#include "HAL/IConsoleManager.h"
+#include "Sound/SoundCue.h"
+
+#include "Character/PBPlayerMovement.h"
+
+static TAutoConsoleVariable<float> CVarFootstepMaxDistance(TEXT("pb.Footsteps.MaxDistance"), 4000.0f, TEXT("Footsteps farther than this from every listener are not played. 0 disables distance culling.\n"), ECVF_Default);
+static TAutoConsoleVariable<int32> CVarFootstepMaxPerFrame(TEXT("pb.Footsteps.MaxPerFrame"), 8, TEXT("Maximum number of footstep, jump and land sounds started per frame, closest to the listeners first.\n"), ECVF_Default);
+static TAutoConsoleVariable<int32> CVarFootstepMaxPerSurface(TEXT("pb.Footsteps.MaxPerSurface"), 4, TEXT("Maximum number of footstep, jump and land sounds started per frame on the same surface type.\n"), ECVF_Default);
+
+DECLARE_DWORD_COUNTER_STAT(TEXT("Footsteps Queued"), STAT_PBFootstepsQueued, STATGROUP_PBMovement);
+DECLARE_DWORD_COUNTER_STAT(TEXT("Footsteps Played"), STAT_PBFootstepsPlayed, STATGROUP_PBMovement);
+
+bool UPBFootstepSubsystem::ShouldCreateSubsystem(UObject* Outer) const
+{
+	// Nobody listens on dedicated servers
+	return !IsRunningDedicatedServer() && Super::ShouldCreateSubsystem(Outer);
+}
+
+void UPBFootstepSubsystem::Deinitialize()
+{
+	Requests.Empty();
+	Super::Deinitialize();
+}
+
+TStatId UPBFootstepSubsystem::GetStatId() const
+{
+	RETURN_QUICK_DECLARE_CYCLE_STAT(UPBFootstepSubsystem, STATGROUP_Tickables);
+}
+
+void UPBFootstepSubsystem::QueueFootstep(UPBPlayerMovement* Movement, USoundCue* Sound, float VolumeMultiplier, const FVector& Location, EPhysicalSurface SurfaceType)
+{
+	if (!Sound)
+	{
+		return;
+	}
+
+	FPBFootstepRequest& Request = Requests.AddDefaulted_GetRef();
+	Request.Movement = Movement;
+	Request.Sound = Sound;
+	Request.VolumeMultiplier = VolumeMultiplier;
+	Request.Location = Location;
+	Request.SurfaceType = SurfaceType;
+	INC_DWORD_STAT(STAT_PBFootstepsQueued);
+}
+
+void UPBFootstepSubsystem::Tick(float DeltaTime)
+{
+	Super::Tick(DeltaTime);
+
+	if (Requests.Num() == 0)
+	{
+		return;
+	}
+
+	ListenerLocations.Reset();
+	for (FConstPlayerControllerIterator It = GetWorld()->GetPlayerControllerIterator(); It; ++It)
+	{
+		const APlayerController* PlayerController = It->Get();
+		if (PlayerController && PlayerController->IsLocalController())
+		{
+			FVector Location, FrontDir, RightDir;
+			PlayerController->GetAudioListenerPosition(Location, FrontDir, RightDir);
+			ListenerLocations.Add(Location);
+		}
+	}
+
+	// Distance to the closest listener, without listeners everything is at the same distance
+	for (FPBFootstepRequest& Request : Requests)
+	{
+		Request.ListenerDistSquared = ListenerLocations.Num() > 0 ? MAX_flt : 0.0f;
+		for (const FVector& ListenerLocation : ListenerLocations)
+		{
+			Request.ListenerDistSquared = FMath::Min(Request.ListenerDistSquared, FVector::DistSquared(Request.Location, ListenerLocation));
+		}
+	}
+
+	Requests.Sort([](const FPBFootstepRequest& A, const FPBFootstepRequest& B)
+	{
+		return A.ListenerDistSquared < B.ListenerDistSquared;
+	});
+
+	const float MaxDistance = CVarFootstepMaxDistance.GetValueOnGameThread();
+	const float MaxDistSquared = MaxDistance > 0.0f ? FMath::Square(MaxDistance) : MAX_flt;
+	const int32 MaxPerFrame = CVarFootstepMaxPerFrame.GetValueOnGameThread();
+	const int32 MaxPerSurface = CVarFootstepMaxPerSurface.GetValueOnGameThread();
+	int32 SurfaceCounts[SurfaceType_Max] = {};
+	int32 NumPlayed = 0;
+	for (const FPBFootstepRequest& Request : Requests)
+	{
+		// Everything after is too far to be heard, or over budget
+		if (NumPlayed >= MaxPerFrame || Request.ListenerDistSquared > MaxDistSquared)
+		{
+			break;
+		}
+		if (SurfaceCounts[Request.SurfaceType] >= MaxPerSurface)
+		{
+			continue;
+		}
+
+		UPBPlayerMovement* Movement = Request.Movement.Get();
+		USoundCue* Sound = Request.Sound.Get();
+		if (!Movement || !Sound)
+		{
+			continue;
+		}
+
+		Movement->PlayFootstepSound(Sound, Request.VolumeMultiplier, Request.Location);
+		SurfaceCounts[Request.SurfaceType]++;
+		NumPlayed++;
+	}
+	INC_DWORD_STAT_BY(STAT_PBFootstepsPlayed, NumPlayed);
+
+	Requests.Reset();
+}
@@ -0,0 +1,76 @@
+// Copyright Project Borealis
+
+#include "Sound/PBMoveStepSound.h"
+
+#include "Engine/AssetManager.h"
+#include "Sound/SoundCue.h"
+
+void UPBMoveStepSound::LoadSounds(FSimpleDelegate OnLoaded)
+{
+	if (bSoundsLoaded)
+	{
+		OnLoaded.ExecuteIfBound();
+		return;
+	}
+
+	PendingLoadCallbacks.Add(MoveTemp(OnLoaded));
+	if (LoadHandle.IsValid())
+	{
+		// Already loading
+		return;
+	}
+
+	TArray<FSoftObjectPath> SoundPaths;
+	for (const TArray<TSoftObjectPtr<USoundCue>>* Sounds : { &StepLeftSounds, &StepRightSounds, &SprintLeftSounds, &SprintRightSounds, &JumpSounds, &LandSounds })
+	{
+		for (const TSoftObjectPtr<USoundCue>& Sound : *Sounds)
+		{
+			if (!Sound.IsNull())
+			{
+				SoundPaths.AddUnique(Sound.ToSoftObjectPath());
+			}
+		}
+	}
+
+	if (SoundPaths.Num() == 0)
+	{
+		OnSoundsLoaded();
+		return;
+	}
+
+	LoadHandle = UAssetManager::GetStreamableManager().RequestAsyncLoad(SoundPaths, FStreamableDelegate::CreateUObject(this, &UPBMoveStepSound::OnSoundsLoaded));
+}
+
+void UPBMoveStepSound::OnSoundsLoaded()
+{
+	if (!bSoundsLoaded)
+	{
+		const auto ResolveSounds = [](const TArray<TSoftObjectPtr<USoundCue>>& Sounds, TArray<USoundCue*>& OutLoadedSounds)
+		{
+			OutLoadedSounds.Reset(Sounds.Num());
+			for (const TSoftObjectPtr<USoundCue>& Sound : Sounds)
+			{
+				if (USoundCue* LoadedSound = Sound.Get())
+				{
+					OutLoadedSounds.Add(LoadedSound);
+				}
+			}
+		};
+		ResolveSounds(StepLeftSounds, LoadedStepLeftSounds);
+		ResolveSounds(StepRightSounds, LoadedStepRightSounds);
+		ResolveSounds(SprintLeftSounds, LoadedSprintLeftSounds);
+		ResolveSounds(SprintRightSounds, LoadedSprintRightSounds);
+		ResolveSounds(JumpSounds, LoadedJumpSounds);
+		ResolveSounds(LandSounds, LoadedLandSounds);
+		bSoundsLoaded = true;
+	}
+
+	// The loaded lists keep the sounds alive
+	LoadHandle.Reset();
+
+	TArray<FSimpleDelegate> Callbacks = MoveTemp(PendingLoadCallbacks);
+	for (FSimpleDelegate& Callback : Callbacks)
+	{
+		Callback.ExecuteIfBound();
+	}
+}
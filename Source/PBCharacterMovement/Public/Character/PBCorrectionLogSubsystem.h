@@ -0,0 +1,41 @@
+// Copyright Project Borealis
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "Subsystems/WorldSubsystem.h"
+
+#include "Character/PBPlayerMovement.h"
+
+#include "PBCorrectionLogSubsystem.generated.h"
+
+/**
+ * Writes the client corrections sent by the server of a world to a binary file, when pb.Corrections.Log is set.
+ * Records are buffered and written a few times per minute, so bursts of corrections don't block the frame on disk.
+ */
+UCLASS()
+class PBCHARACTERMOVEMENT_API UPBCorrectionLogSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Deinitialize() override;
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+	/** Queue a correction, written on the next flush */
+	void AddRecord(const FPBCorrectionRecord& Record);
+
+private:
+	/** Write the queued records and flush the file, opening it if needed */
+	void FlushRecords();
+	void CloseLog();
+
+	TArray<FPBCorrectionRecord> PendingRecords;
+	/** Log file of this world, opened on the first flush */
+	TUniquePtr<FArchive> Log;
+	bool bLogFailed = false;
+	/** Seconds since the last flush */
+	float TimeSinceFlush = 0.0f;
+};
@@ -4,8 +4,12 @@
 
 #include "CoreMinimal.h"
 
+#include "Containers/StaticArray.h"
 #include "GameFramework/Character.h"
 
+#include "LagCompensation/PBLagCompensationSubsystem.h"
+#include "Sound/PBMoveStepSound.h"
+
 #include "PBPlayerCharacter.generated.h"
 
 class USoundCue;
@@ -40,6 +44,9 @@ public:
 
 	void RecalculateBaseEyeHeight() override;
 
+	/** Move the mesh with a capsule already crouching, like OnStartCrouch does but without the crouch events */
+	void AdjustCrouchedMesh(float HalfHeightAdjust);
+
 	/* Triggered when player's movement mode has changed */
 	void OnMovementModeChanged(EMovementMode PrevMovementMode, uint8 PrevCustomMode) override;
 
@@ -78,6 +85,55 @@ private:
 	UPROPERTY(EditDefaultsOnly, meta = (AllowPrivateAccess = "true"), Category = "PB Player|Sounds")
 	TMap<TEnumAsByte<EPhysicalSurface>, TSubclassOf<UPBMoveStepSound>> MoveStepSounds;
 
+	/** MoveStepSounds resolved for every surface, so footsteps don't look them up */
+	TStaticArray<FPBMoveStepSoundSet, SurfaceType_Max> MoveStepSoundSets;
+
+	/** Surface the server found us standing on, so simulated proxies don't trace for footsteps */
+	UPROPERTY(Replicated)
+	TEnumAsByte<EPhysicalSurface> ReplicatedFloorSurface = SurfaceType_Default;
+
+	/** Crouch progress of the server, quantized to a byte, so simulated proxies can play the crouch transition */
+	UPROPERTY(Replicated)
+	uint8 ReplicatedCrouchAlpha = 0;
+
+	/** Surfaces we requested the sounds of, one bit per surface type */
+	uint64 RequestedMoveStepSounds = 0;
+	static_assert(SurfaceType_Max <= 64, "RequestedMoveStepSounds needs a bit per surface type");
+
+	/** Stream in the sounds of a surface, the sound sets are rebuilt once they are loaded */
+	void LoadMoveStepSounds(EPhysicalSurface Surface);
+
+	/**
+	 * Scale our net update frequency with how much our movement is changing, so idle players cost less bandwidth.
+	 * Moves between the configured MinNetUpdateFrequency, for idle or steady players, and NetUpdateFrequency.
+	 */
+	UPROPERTY(EditDefaultsOnly, meta = (AllowPrivateAccess = "true"), Category = "PB Player|Replication")
+	bool bAdaptiveNetUpdateFrequency = false;
+
+	/** Speed at which we replicate at the max frequency */
+	UPROPERTY(EditDefaultsOnly, meta = (AllowPrivateAccess = "true", EditCondition = "bAdaptiveNetUpdateFrequency", ClampMin = "1", UIMin = "1", ForceUnits = "cm/s"), Category = "PB Player|Replication")
+	float MaxNetUpdateFrequencySpeed = 1000.0f;
+
+	/** How fast the frequency comes back down once our movement settles, in Hz per second. It goes up immediately. */
+	UPROPERTY(EditDefaultsOnly, meta = (AllowPrivateAccess = "true", EditCondition = "bAdaptiveNetUpdateFrequency", ClampMin = "0", UIMin = "0"), Category = "PB Player|Replication")
+	float NetUpdateFrequencyDecayRate = 60.0f;
+
+	/** Our last capsules, only recorded on the server */
+	FPBCapsuleHistory CapsuleHistory;
+
+	/** NetUpdateFrequency and MinNetUpdateFrequency we were configured with, the adaptive frequency stays between them */
+	float ConfiguredMaxNetUpdateFrequency = 0.0f;
+	float ConfiguredMinNetUpdateFrequency = 0.0f;
+
+	/** Acceleration at the last net update frequency update */
+	FVector LastNetUpdateAcceleration = FVector::ZeroVector;
+
+	/** Pick our net update frequency from our speed and acceleration changes */
+	void UpdateNetUpdateFrequency(float DeltaTime);
+
+	void SetNetUpdateFrequencyCompat(float Frequency);
+	float GetNetUpdateFrequencyCompat() const;
+
 		/** Minimum speed to play the camera shake for landing */
 	UPROPERTY(EditDefaultsOnly, meta = (AllowPrivateAccess = "true"), Category = "PB Player|Damage")
 	float MinLandBounceSpeed;
@@ -119,9 +175,12 @@ private:
 
 protected:
 	virtual void BeginPlay();
+	virtual void EndPlay(const EEndPlayReason::Type EndPlayReason) override;
 public:
 	APBPlayerCharacter(const FObjectInitializer& ObjectInitializer);
 
+	virtual void GetLifetimeReplicatedProps(TArray<FLifetimeProperty>& OutLifetimeProps) const override;
+
 #pragma region Mutators
 	UFUNCTION()
 	bool IsSprinting() const
@@ -139,10 +198,40 @@ public:
 	{
 		return bWantsToWalk;
 	}
+	UFUNCTION()
+	void SetWantsToWalk(bool Value)
+	{
+		bWantsToWalk = Value;
+	};
 	FORCEINLINE TSubclassOf<UPBMoveStepSound>* GetMoveStepSound(TEnumAsByte<EPhysicalSurface> Surface)
 	{
 		return MoveStepSounds.Find(Surface);
 	};
+	/** Sounds to play on a surface. Starts loading them on first use, the default surface sounds are used until then. */
+	const FPBMoveStepSoundSet& GetMoveStepSoundSet(EPhysicalSurface Surface);
+	EPhysicalSurface GetReplicatedFloorSurface() const
+	{
+		return ReplicatedFloorSurface;
+	}
+	/** Only replicated when it changes */
+	void SetReplicatedFloorSurface(EPhysicalSurface Surface)
+	{
+		ReplicatedFloorSurface = Surface;
+	}
+	float GetReplicatedCrouchAlpha() const
+	{
+		return ReplicatedCrouchAlpha / 255.0f;
+	}
+	/** Only replicated when the quantized value changes */
+	void SetReplicatedCrouchAlpha(float Alpha)
+	{
+		ReplicatedCrouchAlpha = (uint8)FMath::RoundToInt(FMath::Clamp(Alpha, 0.0f, 1.0f) * 255.0f);
+	}
+	/** Resolve the sounds of every surface again, needed after changing MoveStepSounds */
+	void RebuildMoveStepSoundSets();
+	/** Start loading the sounds of surfaces we are about to walk on, such as the ones used by the map */
+	UFUNCTION(BlueprintCallable, Category = "PB Player|Sounds")
+	void PreloadMoveStepSounds(const TArray<TEnumAsByte<EPhysicalSurface>>& Surfaces);
 	UFUNCTION(Category = "PB Getters", BlueprintPure) FORCEINLINE float GetBaseTurnRate() const
 	{
 		return BaseTurnRate;
@@ -176,6 +265,18 @@ public:
 
 	float GetDefaultBaseEyeHeight() const { return DefaultBaseEyeHeight; }
 
+	/** Capsules we had over the last frames, for lag compensation. Empty on clients. */
+	const FPBCapsuleHistory& GetCapsuleHistory() const
+	{
+		return CapsuleHistory;
+	}
+
+	/** Add our current capsule to the history */
+	void RecordCapsule(float Time);
+
+	/** Our movement changed in a way others need to know right away (jump, land, slide, ladder), replicate now at full rate */
+	void NotifyMovementTransition();
+
 	UFUNCTION()
 	void ToggleNoClip();
 
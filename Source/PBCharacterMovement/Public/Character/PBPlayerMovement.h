@@ -5,11 +5,19 @@
 #include "CoreMinimal.h"
 
 #include "GameFramework/CharacterMovementComponent.h"
+#include "WorldCollision.h"
 
 #include "Runtime/Launch/Resources/Version.h"
 
+// FOverlapResult moved out of WorldCollision.h
+#if ENGINE_MAJOR_VERSION == 5 && ENGINE_MINOR_VERSION >= 2
+#include "Engine/OverlapResult.h"
+#endif
+
 #include "PBPlayerMovement.generated.h"
 
+DECLARE_STATS_GROUP(TEXT("PBMovement"), STATGROUP_PBMovement, STATCAT_Advanced);
+
 #define LADDER_MOUNT_TIMEOUT 0.2f
 
 // Crouch Timings (in seconds)
@@ -18,7 +26,9 @@
 #define MOVEMENT_DEFAULT_UNCROUCHTIME 0.2f
 #define MOVEMENT_DEFAULT_UNCROUCHJUMPTIME 0.8f
 
+class UAudioComponent;
 class USoundCue;
+class UPhysicalMaterial;
 
 UENUM(BlueprintType, meta = (Bitflags, UseEnumValuesAsMaskValuesInEditor = "true"))
 enum class EWaterJumpMode : uint8
@@ -37,6 +47,247 @@ struct FLadderData
 	FVector Right;
 };
 
+/** A place where the player can step off a ladder */
+struct FPBLadderDismount
+{
+	/** Range of the ladder space coordinate (along FLadderData::Up) where FindFloor can reach the floor */
+	float MinCoord;
+	float MaxCoord;
+	/** The floor found when the dismount was computed */
+	FHitResult FloorHit;
+};
+
+/** Room above the capsule, measured once and reused while we are stuck under the same ceiling */
+struct FPBHeadroomCache
+{
+	/** Capsule location and scaled half height the headroom was measured at */
+	FVector Location = FVector::ZeroVector;
+	float HalfHeight = 0.0f;
+	/** How far up we looked */
+	float MaxRise = 0.0f;
+	/** How far up the top of the capsule can go */
+	float Headroom = 0.0f;
+	/** The ceiling and its transform when we measured */
+	TWeakObjectPtr<UPrimitiveComponent> Blocker;
+	FTransform BlockerTransform;
+	bool bValid = false;
+};
+
+/** Blocking primitives around the path of the capsule, gathered once per tick */
+struct FPBLocalGeometry
+{
+	/** Frame the geometry was gathered on */
+	uint64 FrameNumber = 0;
+	/** Area covered by the snapshot */
+	FBox Bounds = FBox(ForceInit);
+	TArray<TWeakObjectPtr<UPrimitiveComponent>, TInlineAllocator<8>> Components;
+	bool bValid = false;
+};
+
+/** FindFloor result, reused for repeated floor checks from the same spot during the landing checks of a falling iteration */
+struct FPBFloorMemo
+{
+	FVector Location = FVector::ZeroVector;
+	float Radius = 0.0f;
+	float HalfHeight = 0.0f;
+	float MaxStepHeight = 0.0f;
+	float WalkableFloorZ = 0.0f;
+	bool bIsMovingOnGround = false;
+	FFindFloorResult Result;
+	bool bValid = false;
+};
+
+/** Floor trace result shared by friction, footsteps and jump/land sounds for a frame */
+struct FPBFloorSample
+{
+	/** Frame the sample was taken on */
+	uint64 FrameNumber = 0;
+	/** Capsule location the sample was taken from */
+	FVector Location = FVector::ZeroVector;
+	FHitResult Hit;
+	TWeakObjectPtr<UPhysicalMaterial> PhysMaterial;
+	EPhysicalSurface SurfaceType = SurfaceType_Default;
+	float Friction = 1.0f;
+	bool bValid = false;
+};
+
+/** Kinds of scene queries issued by the movement */
+enum class EPBSceneQueryKind : uint8
+{
+	Sweep,
+	LineTrace,
+	Overlap,
+	Num
+};
+
+/** Where the movement issues scene queries from */
+enum class EPBSceneQuerySite : uint8
+{
+	/** Sweeping moves of the capsule */
+	Move,
+	FindFloor,
+	StepUp,
+	/** Complex floor trace for surface friction and sounds */
+	FloorSample,
+	/** Falling hemisphere probe */
+	FallingProbe,
+	LocalGeometry,
+	Uncrouch,
+	Ladder,
+	Num
+};
+
+/** Scene queries issued by a character, by site and kind */
+struct FPBSceneQueryCounters
+{
+	uint64 Counts[(int32)EPBSceneQuerySite::Num][(int32)EPBSceneQueryKind::Num] = {};
+	uint64 Total = 0;
+	/** Frame the first query was counted on */
+	uint64 FirstFrame = 0;
+
+	uint64 GetSiteTotal(EPBSceneQuerySite Site) const;
+	uint64 GetKindTotal(EPBSceneQueryKind Kind) const;
+	/** Average number of queries per frame since the first one was counted */
+	float GetQueriesPerFrame() const;
+};
+
+/** Last network update of a character smoothed with PB extrapolation */
+struct FPBSmoothingSample
+{
+	FVector Location = FVector::ZeroVector;
+	FVector Velocity = FVector::ZeroVector;
+	/** World time of the update */
+	float Time = 0.0f;
+	TEnumAsByte<EMovementMode> MovementMode = MOVE_None;
+	bool bIsCrouched = false;
+	bool bValid = false;
+};
+
+/** PB movement subsystem a client correction is blamed on */
+enum class EPBCorrectionSource : uint8
+{
+	Ladder,
+	PowerSlide,
+	/** Entering or leaving deep water, or swimming */
+	Water,
+	CrouchTransition,
+	CoyoteJump,
+	Other,
+	Num
+};
+
+/** PB state of the server when it corrected a client */
+enum class EPBCorrectionFlags : uint16
+{
+	None = 0,
+	OnLadder = 1 << 0,
+	PowerSliding = 1 << 1,
+	CrouchTransition = 1 << 2,
+	Crouched = 1 << 3,
+	CoyoteTime = 1 << 4,
+	BrakingWindowElapsed = 1 << 5,
+	TouchingWater = 1 << 6,
+	Swimming = 1 << 7,
+	Sprinting = 1 << 8,
+	Walking = 1 << 9,
+};
+ENUM_CLASS_FLAGS(EPBCorrectionFlags);
+
+/** A client correction sent by the server, as written to the correction log */
+struct FPBCorrectionRecord
+{
+	/** Server world time */
+	float ServerTime = 0.0f;
+	float ClientTimeStamp = 0.0f;
+	/** Distance between the client and server locations */
+	float PositionError = 0.0f;
+	uint8 MovementMode = 0;
+	uint8 CustomMovementMode = 0;
+	/** Packed network movement mode the client sent */
+	uint8 ClientMovementMode = 0;
+	EPBCorrectionSource Source = EPBCorrectionSource::Other;
+	EPBCorrectionFlags Flags = EPBCorrectionFlags::None;
+
+	friend FArchive& operator<<(FArchive& Ar, FPBCorrectionRecord& Record);
+};
+
+/**
+ * PB movement state changed by moves, saved with every client move so replays start from the state the move was made with.
+ * Trivially copyable, so saving and restoring it is a memcpy. Optional members are valid when their flag is set.
+ */
+struct FPBMoveState
+{
+	/** A ladder has a dismount at each end */
+	static constexpr int32 MaxLadderDismounts = 2;
+
+	FLadderData LadderData;
+	FLadderData RegrabbableLadderData;
+	/** Ladder dismount zones, without the floor hits they were found with */
+	FVector LadderDismountOrigin;
+	float LadderDismountMinCoords[MaxLadderDismounts];
+	float LadderDismountMaxCoords[MaxLadderDismounts];
+	int32 NumLadderDismounts;
+	double SimulationTime;
+	double PowerSlideEndTime;
+	double LadderRegrabStartTime;
+	double CoyoteStartTime;
+	double GroundedStartTime;
+	float CachedImmersionDepth;
+	float SurfaceFriction;
+	float CrouchAlpha;
+	uint16 bHasLadderData : 1;
+	uint16 bHasRegrabbableLadderData : 1;
+	uint16 bHasLookingUpLadder : 1;
+	uint16 bIsLookingUpLadder : 1;
+	uint16 bAllowRegrabLadder : 1;
+	uint16 bHasCachedImmersionDepth : 1;
+	uint16 bIsPowerSliding : 1;
+	uint16 bCrouchFrameTolerated : 1;
+	uint16 bIsInCrouchTransition : 1;
+	uint16 bHasLadderDismounts : 1;
+};
+static_assert(std::is_trivially_copyable_v<FPBMoveState>, "FPBMoveState is copied around with every saved move");
+
+/** PB state the server sends back when it disagrees with the state hash of a client move */
+USTRUCT()
+struct FPBNetMoveState
+{
+	GENERATED_BODY()
+
+	/** Crouch progress, quantized to a byte */
+	UPROPERTY()
+	uint8 CrouchAlpha = 0;
+
+	UPROPERTY()
+	bool bIsInCrouchTransition = false;
+
+	UPROPERTY()
+	bool bIsPowerSliding = false;
+};
+
+/** Client move data carrying the hash of the PB state the client ended the move with */
+struct PBCHARACTERMOVEMENT_API FPBNetworkMoveData : public FCharacterNetworkMoveData
+{
+	typedef FCharacterNetworkMoveData Super;
+
+	uint8 MoveStateHash = 0;
+
+	virtual void ClientFillNetworkMoveData(const FSavedMove_Character& ClientMove, ENetworkMoveType MoveType) override;
+	virtual bool Serialize(UCharacterMovementComponent& CharacterMovement, FArchive& Ar, UPackageMap* PackageMap, ENetworkMoveType MoveType) override;
+};
+
+struct PBCHARACTERMOVEMENT_API FPBNetworkMoveDataContainer : public FCharacterNetworkMoveDataContainer
+{
+	FPBNetworkMoveDataContainer()
+	{
+		NewMoveData = &PBMoveData[0];
+		PendingMoveData = &PBMoveData[1];
+		OldMoveData = &PBMoveData[2];
+	}
+
+	FPBNetworkMoveData PBMoveData[3];
+};
+
 /** Movement modes for Characters. */
 UENUM(BlueprintType)
 enum ECustomMovementMode : int
@@ -88,6 +339,10 @@ protected:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Character Movement: Walking")
 	float UncrouchJumpTime;
 
+	/** Number of intermediate capsule heights in crouch transitions, the capsule is only resized when reaching one. 0 resizes it every tick. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Character Movement: Walking", meta = (ClampMin = "0", UIMin = "0"))
+	int32 CrouchTransitionSteps = 0;
+
 	/** the minimum step height from moving fast */
 	UPROPERTY(Category = "Character Movement: Walking", EditAnywhere, BlueprintReadWrite)
 	float MinStepHeight;
@@ -100,11 +355,8 @@ protected:
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Character Movement: Jumping / Falling", meta=(ForceUnits="ms"))
 	float CoyoteTime = 200.f;
 
-	/* Progress checked against the Braking Window, incremented in millis. */
-	float BrakingWindowTimeElapsed;
-
-	/** If the player has been on the ground past the Braking Window, start braking. */
-	bool bBrakingWindowElapsed;
+	/** When we last landed, in simulation time. If the player has been on the ground past the Braking Window, start braking. */
+	double GroundedStartTime = -INFINITY;
 
 	/** Wait a frame before crouch speed. */
 	bool bCrouchFrameTolerated = false;
@@ -160,6 +412,37 @@ protected:
 
 	bool bShouldPlayMoveSounds = true;
 
+	/** Find the surface of the next footstep with an async trace sent a frame ahead, instead of tracing when the step is due */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "Character Movement (General Settings)")
+	bool bUseAsyncFootstepTrace = false;
+
+	/** Audio components kept around to play footstep, jump and land sounds. When all of them are playing, the oldest sound is cut off. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "Character Movement (General Settings)", meta = (ClampMin = "1", UIMin = "1"))
+	int32 MaxFootstepAudioComponents = 3;
+
+	/** Smooth network updates by extrapolating with the PB movement rules instead of interpolating, so fast players don't rubber band at low update rates */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Character Movement (Networking)")
+	bool bUseExtrapolatedNetworkSmoothing = false;
+
+	/** How far past the last network update we extrapolate */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Character Movement (Networking)", meta = (EditCondition = "bUseExtrapolatedNetworkSmoothing", ClampMin = "0", UIMin = "0", ForceUnits = "s"))
+	float MaxSmoothingExtrapolationTime = 0.25f;
+
+	/** Fastest the mesh catches up with a correction when extrapolating */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Character Movement (Networking)", meta = (EditCondition = "bUseExtrapolatedNetworkSmoothing", ClampMin = "0", UIMin = "0", ForceUnits = "cm/s"))
+	float MaxSmoothingCorrectionSpeed = 1500.0f;
+
+	/** Largest half extent of the area gathered around the capsule for the falling hemisphere probe. Larger moves trace the world instead. */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, AdvancedDisplay, Category = "Character Movement: Jumping / Falling", meta = (ClampMin = "0", UIMin = "0", ForceUnits = "cm"))
+	float MaxLocalGeometryExtent = 512.0f;
+
+	/**
+	 * Read surface friction from the physical material returned by FindFloor, only tracing complex collision when the simple collision
+	 * has the default material. Meshes setting their friction with per section materials need the complex trace.
+	 */
+	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Character Movement: Walking")
+	bool bUseFloorHitForSurfaceFriction = false;
+
 	/** The multiplier for acceleration when swimming. */
 	UPROPERTY(EditAnywhere, BlueprintReadWrite, Category = "Character Movement: Swimming", meta = (DisplayAfter = "Buoyancy"))
 	float FluidAccelerationMultiplier;
@@ -290,9 +573,23 @@ public:
 	virtual void UnCrouch(bool bClientSimulation = false) override;
 	virtual void DoCrouchResize(float TargetTime, float DeltaTime, bool bClientSimulation = false);
 	virtual void DoUnCrouchResize(float TargetTime, float DeltaTime, bool bClientSimulation = false);
+
+	/** Crouch progress, from 0 (standing) to 1 (crouched). Smooth even when the capsule height is quantized. */
+	float GetCrouchAlpha() const;
+	/** Offset of the view from BaseEyeHeight, so it follows the crouch progress rather than the quantized capsule */
+	float GetCrouchEyeHeightOffset() const;
+
+	/** How far the top of the capsule can rise (up to MaxRise) before hitting the ceiling */
+	float GetUncrouchHeadroom(float MaxRise);
 	
 	bool MoveUpdatedComponentImpl(const FVector& Delta, const FQuat& NewRotation, bool bSweep, FHitResult* OutHit = nullptr, ETeleportType Teleport = ETeleportType::None) override;
 
+	/** Gather the blocking primitives we can reach this tick */
+	void GatherLocalGeometry(float DeltaTime);
+	bool IsCoveredByLocalGeometry(const FVector& Start, const FVector& End) const;
+	/** Line trace against the gathered primitives only */
+	bool LineTraceLocalGeometry(FHitResult& OutHit, const FVector& Start, const FVector& End, const FCollisionQueryParams& Params) const;
+
 	// Jump overrides
 	bool CanAttemptJump() const override;
 	bool DoJump(bool bClientSimulation) override;
@@ -305,8 +602,19 @@ public:
 	bool IsWithinEdgeTolerance(const FVector& CapsuleLocation, const FVector& TestImpactPoint, const float CapsuleRadius) const override;
 	bool IsValidLandingSpot(const FVector& CapsuleLocation, const FHitResult& Hit) const override;
 	bool ShouldCheckForValidLandingSpot(float DeltaTime, const FVector& Delta, const FHitResult& Hit) const override;
+	void FindFloor(const FVector& CapsuleLocation, FFindFloorResult& OutFloorResult, bool bCanUseCachedResult, const FHitResult* DownwardSweepResult = nullptr) const override;
+	void ComputeFloorDist(const FVector& CapsuleLocation, float LineDistance, float SweepDistance, FFindFloorResult& OutFloorResult, float SweepRadius, const FHitResult* DownwardSweepResult = nullptr) const override;
+	bool FloorSweepTest(FHitResult& OutHit, const FVector& Start, const FVector& End, ECollisionChannel TraceChannel, const FCollisionShape& CollisionShape, const FCollisionQueryParams& Params, const FCollisionResponseParams& ResponseParam) const override;
+	void InitCollisionParams(FCollisionQueryParams& OutParams, FCollisionResponseParams& OutResponseParam) const override;
+
+	bool StepUp(const FVector& GravDir, const FVector& Delta, const FHitResult& Hit, FStepDownResult* OutStepDownResult = nullptr) override;
 
 	void TraceCharacterFloor(FHitResult& OutHit);
+	/** Query parameters and path of the complex floor trace */
+	void InitFloorTrace(FCollisionQueryParams& OutParams, FCollisionResponseParams& OutResponseParam, FVector& OutStart, FVector& OutEnd) const;
+
+	/** Get the floor under the character, tracing at most once per frame and location */
+	const FPBFloorSample& GetFloorSample();
 
 	// Acceleration
 	FORCEINLINE FVector GetAcceleration() const
@@ -330,12 +638,14 @@ public:
 
 	bool IsBrakingWindowTolerated() const
 	{
-		return bBrakingWindowElapsed;
+		return IsMovingOnGround() && GetSimulationTimeSince(GroundedStartTime) >= BrakingWindow;
 	}
 
 	virtual float GetMaxSpeed() const override;
 	virtual float GetMaxBrakingDeceleration() const override;
 
+	virtual FNetworkPredictionData_Client* GetPredictionData_Client() const override;
+
 	bool IsWaterJumpAllowed(const EWaterJumpMode& Mode) const
 	{
 		return (WaterJumpMode & ((uint8)Mode));
@@ -348,11 +658,33 @@ public:
 
 	bool IsInCoyoteTime() const
 	{
-		return !FMath::IsNearlyZero(CoyoteTime) && CoyoteTimeElapsed <= CoyoteTime;
+		return !FMath::IsNearlyZero(CoyoteTime) && IsFalling() && GetSimulationTimeSince(CoyoteStartTime) <= CoyoteTime;
 	}
 
 	FVector GetLadderJumpVelocity() const;
 
+	/** Play a footstep, jump or land sound on a pooled audio component */
+	void PlayFootstepSound(USoundCue* Sound, float VolumeMultiplier, const FVector& Location);
+
+	/** Ladder, slide and crouch state packed in a byte, compared by the server to detect diverging client moves */
+	uint8 GetMoveStateHash() const;
+
+	/** Copy out the PB state changed by moves, saved with client moves for prediction */
+	void SaveMoveState(FPBMoveState& OutState) const;
+	/** Put back PB state copied out by SaveMoveState */
+	void RestoreMoveState(const FPBMoveState& State);
+
+	/** Scene queries issued since the counters were last reset (not counted in shipping builds) */
+	const FPBSceneQueryCounters& GetSceneQueryCounters() const
+	{
+		return SceneQueryCounters;
+	}
+
+	void ResetSceneQueryCounters()
+	{
+		SceneQueryCounters = FPBSceneQueryCounters();
+	}
+
 protected:
 	virtual void PhysicsVolumeChanged(class APhysicsVolume* NewVolume) override;
 	virtual bool IsInWater() const override;
@@ -367,8 +699,24 @@ protected:
 	virtual void SetPostLandedPhysics(const FHitResult& Hit) override;
 	virtual void PhysCustom(float deltaTime, int32 Iterations) override;
 
+	// Prediction of the sprint and walk inputs
+	virtual void UpdateFromCompressedFlags(uint8 Flags) override;
+	virtual bool ClientUpdatePositionAfterServerUpdate() override;
+
+	// Extrapolated network smoothing
+	virtual void SmoothCorrection(const FVector& OldLocation, const FQuat& OldRotation, const FVector& NewLocation, const FQuat& NewRotation) override;
+	virtual void SmoothClientPosition(float DeltaSeconds) override;
+
+	/** Records the corrections sent to the client, by PB movement mode, and compares the PB state hash of the client move with ours once the move is simulated */
+	virtual void ServerMove_PerformMovement(const FCharacterNetworkMoveData& MoveData) override;
+
+	/** Sent when the PB state diverged but the engine found no position error to correct */
+	UFUNCTION(Client, Unreliable)
+	void ClientAdjustPBState(float TimeStamp, FPBNetMoveState State);
+
 	bool bIsPowerSliding = false;
-	float PowerSlidingTimeElapsed = INFINITY;
+	/** When we last stopped powersliding, in simulation time. Starts the slide boost cooldown. */
+	double PowerSlideEndTime = -INFINITY;
 	virtual void StartPowerSlide(bool IsBoostedSlide);
 	virtual void EndPowerSlide();
 	virtual bool MustStopPowerSlide() const;
@@ -379,33 +727,185 @@ protected:
 	TOptional<bool> bIsLookingUpLadder;
 	bool bAllowRegrabLadder;
 	bool bForceLeaveLadder;
-	float LadderRegrabTimeElapsed = INFINITY;
+	/** When we slipped off the ladder we may regrab, in simulation time */
+	double LadderRegrabStartTime = -INFINITY;
 	virtual void PhysLadder(float deltaTime, int32 Iterations);
 	virtual float ClimbLadder(FVector Delta, FHitResult& Hit);
 	bool OverlapsLadder(const FLadderData& Ladder);
+	/** Build the ladder data of a registered ladder we overlap, facing the side we are on */
+	bool FindOverlappedLadder(FLadderData& OutLadder);
+
+	/** Dismount zones of the current ladder, computed once when grabbing it */
+	TArray<FPBLadderDismount, TInlineAllocator<FPBMoveState::MaxLadderDismounts>> LadderDismounts;
+	/** Origin of the ladder space coordinates */
+	FVector LadderDismountOrigin;
+	/** If false, the ladder bounds are unknown and the floor is checked every tick */
+	bool bHasLadderDismounts = false;
+	void ComputeLadderDismounts(const FLadderData& Ladder);
+	bool IsNearLadderDismount() const;
 	
 public:
 	virtual bool GrabLadder(const FLadderData& Ladder);
 
 private:
+	/** Are move sounds audible here? False on dedicated servers and worlds without an audio device. */
+	bool CanPlayMoveSounds() const;
+
 	/** Plays sound effect according to movement and surface */
 	void PlayMoveSound(float DeltaTime);
 
-	class UPBMoveStepSound* GetMoveStepSoundBySurface(EPhysicalSurface SurfaceType) const;
-
-
-	virtual void PlayJumpSound(const FHitResult& Hit, bool bJumped);
+	/** Crouch progress given by the current capsule height */
+	float GetCapsuleCrouchAlpha() const;
+	/** Crouch progress of the capsule step we are at, rounded towards crouching or standing */
+	float QuantizeCrouchAlpha(float Alpha, bool bRoundDown) const;
+
+	/** Move a simulated proxy through its crouch transition, toward the progress replicated by the server */
+	void UpdateProxyCrouching(float DeltaTime);
+	/** Set the crouch progress of a simulated proxy and resize its capsule to match */
+	void ResizeProxyCapsule(float NewAlpha);
+
+	/** Record a scene query in the stats, the CSV profile and our counters */
+	void CountSceneQuery(EPBSceneQueryKind Kind, EPBSceneQuerySite Site) const;
+
+	/** Where the last network update would have taken us after some time, in the air or sliding */
+	FVector ExtrapolateSmoothingSample(float Time) const;
+
+	/** Describe our state for a correction of a client in the given network movement mode */
+	FPBCorrectionRecord MakeCorrectionRecord(float ClientTimeStamp, const FVector& ClientLoc, uint8 ClientMovementMode) const;
+	/** Record a correction in the stats, the CSV profile and the correction log */
+	void CountCorrection(const FPBCorrectionRecord& Record) const;
+
+
+	virtual void PlayJumpSound(EPhysicalSurface SurfaceType, bool bJumped);
+
+	/** Send the floor trace for the next footstep */
+	void RequestFootstepTrace();
+	void OnFootstepTraceDone(const FTraceHandle& TraceHandle, FTraceDatum& TraceDatum);
+	/** Surface to play the next footstep on, from the async trace if it came back, else traced now */
+	EPhysicalSurface GetFootstepSurface();
+	/**
+	 * Surface we stand on, given by the server on simulated proxies. The same surface that sets our friction, so the owner and
+	 * simulated proxies hear the same footsteps: the FindFloor material when it is used for friction, else traced now.
+	 */
+	EPhysicalSurface GetFloorSurface();
+	/** Does the FindFloor hit give our friction and surface, without a complex trace? */
+	bool UsesFloorHitMaterial() const;
+
+	FTraceHandle FootstepTraceHandle;
+	FTraceDelegate FootstepTraceDelegate;
+	uint64 FootstepSurfaceFrame = 0;
+	EPhysicalSurface FootstepSurfaceType = SurfaceType_Default;
+	bool bHasFootstepSurface = false;
+
+	/** Play one of these footstep, jump or land sounds at our feet, through the world footstep queue when there is one */
+	void QueueFootstepSound(const TArray<USoundCue*>& Sounds, float VolumeMultiplier, EPhysicalSurface SurfaceType);
+	UAudioComponent* GetFootstepAudioComponent();
+
+	UPROPERTY(Transient)
+	TArray<UAudioComponent*> FootstepAudioComponents;
+	/** Where to start looking for an idle footstep component, the one played the longest ago */
+	int32 NextFootstepAudioComponent = 0;
 
 	float DefaultStepHeight;
 	float DefaultWalkableFloorZ;
 	float SurfaceFriction;
-	float CoyoteTimeElapsed = INFINITY;
+	/** When we walked off a ledge, in simulation time */
+	double CoyoteStartTime = -INFINITY;
+
+	/**
+	 * Seconds of movement we simulated, advanced by every move so timers agree on client, server and replays.
+	 * Part of FPBMoveState, so combined and replayed moves rewind it and never count a move twice.
+	 */
+	double SimulationTime = 0.0;
+
+	/** Millis of simulation time since a timestamp, infinite for timestamps never set */
+	double GetSimulationTimeSince(double StartTime) const
+	{
+		return (SimulationTime - StartTime) * 1000.0;
+	}
 
 	TOptional<float> CachedImmersionDepth;
 
+	/** Crouch progress, ahead of the capsule when transitions are quantized */
+	float CrouchAlpha = 0.0f;
+
+	/** Geometry around us for the current tick, used by the falling hemisphere probe */
+	FPBLocalGeometry LocalGeometry;
+	/** Scratch overlap results, kept around to avoid reallocating */
+	TArray<FOverlapResult> LocalGeometryOverlaps;
+
+	/** Last headroom measure, reused while uncrouching under the same ceiling */
+	FPBHeadroomCache HeadroomCache;
+
+	/** Last floor sample, reused while we don't move during a frame */
+	FPBFloorSample FloorSample;
+
+	/** Set during the landing checks of a falling iteration, so FindFloor results from the same spot are reused */
+	bool bMemoizeFindFloor = false;
+	mutable FPBFloorMemo FloorMemo;
+
+	/** Set during StepUp, so its moves and floor checks are counted as step up queries */
+	bool bIsSteppingUp = false;
+
+	mutable FPBSceneQueryCounters SceneQueryCounters;
+
+	/** Set while the engine computes the floor, so the floor query also returns physical materials */
+	mutable bool bIsComputingFloorDist = false;
+
 	/** The time that the player can remount on the ladder */
 	float OffLadderTicks = -1.0f;
 
 	bool bHasDeferredMovementMode;
 	EMovementMode DeferredMovementMode;
+
+	/** Client move data with the PB state hash */
+	FPBNetworkMoveDataContainer PBNetworkMoveDataContainer;
+
+	/** Last network update, extrapolated from when smoothing */
+	FPBSmoothingSample SmoothingSample;
+	/** Offset of the mesh from where the extrapolation puts it, left by the last correction */
+	FVector SmoothingError = FVector::ZeroVector;
+
+	/** When we last sent a PB state correction, they are throttled like the engine's corrections */
+	float LastPBStateAdjustmentTime = -1.0f;
+};
+
+/** Saved move carrying the sprint and walk inputs, and the PB state the move started with */
+class PBCHARACTERMOVEMENT_API FSavedMove_PB : public FSavedMove_Character
+{
+public:
+	typedef FSavedMove_Character Super;
+
+	enum EPBCompressedFlags
+	{
+		FLAG_WantsToSprint = FLAG_Custom_0,
+		FLAG_WantsToWalk = FLAG_Custom_1,
+	};
+
+	virtual void Clear() override;
+	virtual uint8 GetCompressedFlags() const override;
+	virtual bool CanCombineWith(const FSavedMovePtr& NewMove, ACharacter* InCharacter, float MaxDelta) const override;
+	virtual void CombineWith(const FSavedMove_Character* OldMove, ACharacter* InCharacter, APlayerController* PC, const FVector& OldStartLocation) override;
+	virtual void SetMoveFor(ACharacter* C, float InDeltaTime, FVector const& NewAccel, FNetworkPredictionData_Client_Character& ClientData) override;
+	virtual void PrepMoveFor(ACharacter* C) override;
+	virtual void PostUpdate(ACharacter* C, EPostUpdateMode PostUpdateMode) override;
+
+	uint32 bWantsToSprint : 1;
+	uint32 bWantsToWalk : 1;
+
+	/** PB state the move starts with. Replays start over from the one of the first replayed move. */
+	FPBMoveState StartState;
+
+	/** GetMoveStateHash once the move was made, checked by the server */
+	uint8 EndStateHash;
+};
+
+class PBCHARACTERMOVEMENT_API FNetworkPredictionData_Client_PB : public FNetworkPredictionData_Client_Character
+{
+public:
+	typedef FNetworkPredictionData_Client_Character Super;
+
+	FNetworkPredictionData_Client_PB(const UCharacterMovementComponent& ClientMovement);
+
+	virtual FSavedMovePtr AllocateNewMove() override;
 };
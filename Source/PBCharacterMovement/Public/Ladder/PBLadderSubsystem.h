@@ -0,0 +1,62 @@
+// Copyright Project Borealis
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "Subsystems/WorldSubsystem.h"
+#include "UObject/ObjectKey.h"
+
+#include "PBLadderSubsystem.generated.h"
+
+/** Cached oriented bounds of a ladder component */
+struct FPBLadderBounds
+{
+	TWeakObjectPtr<UPrimitiveComponent> Component;
+	/** The transform the bounds were computed with */
+	FTransform ComponentTransform;
+	/** Center of the oriented box, in world space */
+	FVector Center;
+	/** Half size of the box, along Normal, Right and Up */
+	FVector Extent;
+	/** Ladder forward axis (either side of the ladder can be climbed) */
+	FVector Normal;
+	FVector Right;
+	FVector Up;
+
+	/** Does a capsule with the given axis overlap the box? Pure math, no scene query. */
+	bool OverlapsCapsule(const FVector& CapsuleLocation, const FQuat& CapsuleRotation, float CapsuleRadius, float CapsuleHalfHeight) const;
+};
+
+/**
+ * Keeps track of the ladders of a world, so ladder overlaps can be answered analytically.
+ */
+UCLASS()
+class PBCHARACTERMOVEMENT_API UPBLadderSubsystem : public UWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Deinitialize() override;
+
+	/** Register every component of the world using this object type. Only done once per object type. */
+	void RegisterLaddersByObjectType(ECollisionChannel LadderObjectType);
+
+	/** Register a ladder component if needed, and return its bounds */
+	const FPBLadderBounds* RegisterLadder(UPrimitiveComponent* Component);
+
+	void UnregisterLadder(const UPrimitiveComponent* Component);
+
+	/** Get the bounds of a registered ladder, refreshed if the ladder moved */
+	const FPBLadderBounds* FindLadder(const UPrimitiveComponent* Component);
+
+	/** Find a registered ladder overlapping the capsule, or null */
+	UPrimitiveComponent* FindOverlappingLadder(const FVector& CapsuleLocation, const FQuat& CapsuleRotation, float CapsuleRadius, float CapsuleHalfHeight);
+
+private:
+	static void ComputeBounds(UPrimitiveComponent* Component, FPBLadderBounds& OutBounds);
+
+	TMap<TObjectKey<UPrimitiveComponent>, FPBLadderBounds> Ladders;
+
+	TArray<TEnumAsByte<ECollisionChannel>> RegisteredObjectTypes;
+};
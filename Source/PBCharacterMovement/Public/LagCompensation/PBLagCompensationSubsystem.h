@@ -0,0 +1,93 @@
+// Copyright Project Borealis
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "Containers/StaticArray.h"
+#include "Engine/EngineTypes.h"
+#include "Subsystems/WorldSubsystem.h"
+
+#include "PBLagCompensationSubsystem.generated.h"
+
+class APBPlayerCharacter;
+
+/** Capsule of a character at some point in time */
+struct FPBCapsuleSample
+{
+	/** Server world time */
+	float Timestamp = 0.0f;
+	FVector Location = FVector::ZeroVector;
+	FQuat Rotation = FQuat::Identity;
+	/** Changes during crouch transitions, so it is recorded with the transform */
+	float CapsuleHalfHeight = 0.0f;
+	TEnumAsByte<EMovementMode> MovementMode = MOVE_None;
+	uint8 CustomMovementMode = 0;
+};
+
+/** Fixed size ring buffer of the last capsules of a character, oldest first. Never allocates. */
+struct PBCHARACTERMOVEMENT_API FPBCapsuleHistory
+{
+	static constexpr int32 Capacity = 128;
+
+	/** Add the newest sample. A sample no newer than the last one replaces it. */
+	void Record(const FPBCapsuleSample& Sample);
+
+	/** Capsule at the given time, interpolated between the samples around it. False if we don't go back that far. */
+	bool Rewind(float Time, FPBCapsuleSample& OutSample) const;
+
+	void Reset()
+	{
+		Num = 0;
+	}
+
+	int32 GetNum() const
+	{
+		return Num;
+	}
+
+	/** Sample by age, 0 being the oldest */
+	const FPBCapsuleSample& operator[](int32 Index) const
+	{
+		checkSlow(Index >= 0 && Index < Num);
+		return Samples[(Head + Index) % Capacity];
+	}
+
+private:
+	TStaticArray<FPBCapsuleSample, Capacity> Samples;
+	/** Index of the oldest sample */
+	int32 Head = 0;
+	int32 Num = 0;
+};
+
+/** A character rewound by the lag compensation */
+struct FPBRewoundCapsule
+{
+	APBPlayerCharacter* Character = nullptr;
+	FPBCapsuleSample Sample;
+};
+
+/**
+ * Records the capsules of every PB character on the server once per frame, after they all moved,
+ * so hit validation can look up where they were with a binary search instead of replaying moves.
+ */
+UCLASS()
+class PBCHARACTERMOVEMENT_API UPBLagCompensationSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual void Deinitialize() override;
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+	/** Start recording a character. Only characters with authority are recorded. */
+	void RegisterCharacter(APBPlayerCharacter* Character);
+	void UnregisterCharacter(APBPlayerCharacter* Character);
+
+	/** Capsules of every recorded character at the given server time, except the ignored one. Returns how many were found. */
+	int32 RewindAll(float Time, TArray<FPBRewoundCapsule>& OutCapsules, const APBPlayerCharacter* IgnoredCharacter = nullptr) const;
+
+private:
+	TArray<TWeakObjectPtr<APBPlayerCharacter>> Characters;
+};
@@ -0,0 +1,49 @@
+// Copyright Project Borealis
+
+#pragma once
+
+#include "CoreMinimal.h"
+
+#include "Engine/EngineTypes.h"
+#include "Subsystems/WorldSubsystem.h"
+
+#include "PBFootstepSubsystem.generated.h"
+
+class USoundCue;
+class UPBPlayerMovement;
+
+/** A footstep, jump or land sound waiting to be played */
+struct FPBFootstepRequest
+{
+	TWeakObjectPtr<UPBPlayerMovement> Movement;
+	/** Picked when queued, the sound lists can be rebuilt by async loads before we play it */
+	TWeakObjectPtr<USoundCue> Sound;
+	float VolumeMultiplier = 1.0f;
+	FVector Location = FVector::ZeroVector;
+	EPhysicalSurface SurfaceType = SurfaceType_Default;
+	/** Squared distance to the closest listener */
+	float ListenerDistSquared = 0.0f;
+};
+
+/**
+ * Collects the footsteps of every character, and plays the ones closest to the listeners once per frame,
+ * so crowds cost a bounded amount of audio work.
+ */
+UCLASS()
+class PBCHARACTERMOVEMENT_API UPBFootstepSubsystem : public UTickableWorldSubsystem
+{
+	GENERATED_BODY()
+
+public:
+	virtual bool ShouldCreateSubsystem(UObject* Outer) const override;
+	virtual void Deinitialize() override;
+	virtual void Tick(float DeltaTime) override;
+	virtual TStatId GetStatId() const override;
+
+	void QueueFootstep(UPBPlayerMovement* Movement, USoundCue* Sound, float VolumeMultiplier, const FVector& Location, EPhysicalSurface SurfaceType);
+
+private:
+	TArray<FPBFootstepRequest> Requests;
+	/** Scratch listener locations, kept around to avoid reallocating */
+	TArray<FVector> ListenerLocations;
+};
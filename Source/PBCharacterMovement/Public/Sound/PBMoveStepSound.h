@@ -5,6 +5,7 @@
 #include "CoreMinimal.h"
 
 #include "Engine/EngineTypes.h"
+#include "Engine/StreamableManager.h"
 
 #include "PBMoveStepSound.generated.h"
 
@@ -21,22 +22,22 @@ public:
 	TEnumAsByte<enum EPhysicalSurface> GetSurfaceMaterial() const { return SurfaceMaterial; }
 
 	UFUNCTION()
-	TArray<USoundCue*> GetStepLeftSounds() const { return StepLeftSounds; }
+	const TArray<USoundCue*>& GetStepLeftSounds() const { return LoadedStepLeftSounds; }
 
 	UFUNCTION()
-	TArray<USoundCue*> GetStepRightSounds() const { return StepRightSounds; }
+	const TArray<USoundCue*>& GetStepRightSounds() const { return LoadedStepRightSounds; }
 
 	UFUNCTION()
-	TArray<USoundCue*> GetSprintLeftSounds() const { return SprintLeftSounds; }
+	const TArray<USoundCue*>& GetSprintLeftSounds() const { return LoadedSprintLeftSounds; }
 
 	UFUNCTION()
-	TArray<USoundCue*> GetSprintRightSounds() const { return SprintRightSounds; }
+	const TArray<USoundCue*>& GetSprintRightSounds() const { return LoadedSprintRightSounds; }
 
 	UFUNCTION()
-	TArray<USoundCue*> GetJumpSounds() const { return JumpSounds; }
+	const TArray<USoundCue*>& GetJumpSounds() const { return LoadedJumpSounds; }
 
 	UFUNCTION()
-	TArray<USoundCue*> GetLandSounds() const { return LandSounds; }
+	const TArray<USoundCue*>& GetLandSounds() const { return LoadedLandSounds; }
 
 	UFUNCTION()
 	float GetWalkVolume() const { return WalkVolume; }
@@ -44,6 +45,23 @@ public:
 	UFUNCTION()
 	float GetSprintVolume() const { return SprintVolume; }
 
+	/** Are the sounds loaded? The sound getters return empty lists until they are. */
+	bool AreSoundsLoaded() const { return bSoundsLoaded; }
+
+	/** Stream the sounds in. OnLoaded is called once they are, right away if they already are. */
+	void LoadSounds(FSimpleDelegate OnLoaded);
+
+	/** Pick a random sound from the list, null if it is empty */
+	static USoundCue* PickSound(const TArray<USoundCue*>& Sounds)
+	{
+		if (Sounds.Num() < 1)
+		{
+			return nullptr;
+		}
+		// If the array has just one element pick that one skipping random
+		return Sounds[Sounds.Num() == 1 ? 0 : FMath::RandRange(0, Sounds.Num() - 1)];
+	}
+
 private:
 	/** The physical material associated with this move step sound */
 	UPROPERTY(EditDefaultsOnly, Category = Material)
@@ -51,31 +69,71 @@ private:
 
 	/** The list of sounds to randomly choose from when stepping left */
 	UPROPERTY(EditDefaultsOnly, Category = Sounds)
-	TArray<USoundCue*> StepLeftSounds;
+	TArray<TSoftObjectPtr<USoundCue>> StepLeftSounds;
 
 	/** The list of sounds to randomly choose from when stepping right */
 	UPROPERTY(EditDefaultsOnly, Category = Sounds)
-	TArray<USoundCue*> StepRightSounds;
+	TArray<TSoftObjectPtr<USoundCue>> StepRightSounds;
 
 	/** The list of sounds to randomly choose from when sprinting left */
 	UPROPERTY(EditDefaultsOnly, Category = Sounds)
-	TArray<USoundCue*> SprintLeftSounds;
+	TArray<TSoftObjectPtr<USoundCue>> SprintLeftSounds;
 
 	/** The list of sounds to randomly choose from when sprinting right */
 	UPROPERTY(EditDefaultsOnly, Category = Sounds)
-	TArray<USoundCue*> SprintRightSounds;
+	TArray<TSoftObjectPtr<USoundCue>> SprintRightSounds;
 
 	/** The list of sounds to randomly choose from when jumping */
 	UPROPERTY(EditDefaultsOnly, Category = Sounds)
-	TArray<USoundCue*> JumpSounds;
+	TArray<TSoftObjectPtr<USoundCue>> JumpSounds;
 
 	/** The list of sounds to randomly choose from when landing */
 	UPROPERTY(EditDefaultsOnly, Category = Sounds)
-	TArray<USoundCue*> LandSounds;
+	TArray<TSoftObjectPtr<USoundCue>> LandSounds;
+
+	/** The sounds above once loaded, kept here so they stay loaded */
+	UPROPERTY(Transient)
+	TArray<USoundCue*> LoadedStepLeftSounds;
+	UPROPERTY(Transient)
+	TArray<USoundCue*> LoadedStepRightSounds;
+	UPROPERTY(Transient)
+	TArray<USoundCue*> LoadedSprintLeftSounds;
+	UPROPERTY(Transient)
+	TArray<USoundCue*> LoadedSprintRightSounds;
+	UPROPERTY(Transient)
+	TArray<USoundCue*> LoadedJumpSounds;
+	UPROPERTY(Transient)
+	TArray<USoundCue*> LoadedLandSounds;
 
 	UPROPERTY(EditDefaultsOnly, Category = Volume)
 	float WalkVolume = 0.2f;
 
 	UPROPERTY(EditDefaultsOnly, Category = Volume)
 	float SprintVolume = 0.5f;
+
+	void OnSoundsLoaded();
+
+	TSharedPtr<FStreamableHandle> LoadHandle;
+	/** Called once the load in progress completes */
+	TArray<FSimpleDelegate> PendingLoadCallbacks;
+	bool bSoundsLoaded = false;
+};
+
+/** Move step sounds of a surface, with the default surface fallbacks already applied */
+struct FPBMoveStepSoundSet
+{
+	/** Sounds of the surface, or of the default surface if it has none. Null if neither has sounds. */
+	const UPBMoveStepSound* MoveStepSound = nullptr;
+	/** If the surface has its own sounds */
+	bool bHasSurfaceSounds = false;
+	/** The surface has its own sounds, but they are not loaded yet */
+	bool bNeedsLoad = false;
+
+	/** Cues to pick from, never null when MoveStepSound is set */
+	const TArray<USoundCue*>* StepLeftSounds = nullptr;
+	const TArray<USoundCue*>* StepRightSounds = nullptr;
+	const TArray<USoundCue*>* SprintLeftSounds = nullptr;
+	const TArray<USoundCue*>* SprintRightSounds = nullptr;
+	const TArray<USoundCue*>* JumpSounds = nullptr;
+	const TArray<USoundCue*>* LandSounds = nullptr;
 };